@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "compiler.h"
+#include "helpers/buffer.h"
+
+extern struct lex_process_functions compiler_lex_functions;
+
+// Representative input: identifiers, keywords, numbers, operators, strings and comments
+static const char *bench_snippet =
+    "/* generated table entry, keep the layout stable */\n"
+    "static const unsigned int table_entry_value = (first_value + 1234) * second_value - 0xAF58;\n"
+    "if (counter_index <= maximum_count && flags_mask != 0) { total_sum += counter_index << 2; }\n"
+    "// trailing single line comment describing the entry\n"
+    "return \"string literal for the entry\" ;\n";
+
+// The parser only takes numbers so far, compile benchmarks run over these
+static const char *bench_compile_snippet =
+    "12345 67890 0xAF58 0b1101 /* packed constants */ 42 7\n"
+    "// trailing single line comment describing the entry\n";
+
+static double bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct buffer *bench_input(const char *filename, const char *snippet, size_t size)
+{
+    struct buffer *buffer = buffer_create();
+    if (filename)
+    {
+        FILE *fp = fopen(filename, "r");
+        if (!fp)
+        {
+            return NULL;
+        }
+
+        char chunk[4096];
+        size_t amount = 0;
+        while ((amount = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+        {
+            buffer_write_bytes(buffer, chunk, amount);
+        }
+        fclose(fp);
+        return buffer;
+    }
+
+    while (buffer->len < size)
+    {
+        buffer_write_bytes(buffer, snippet, strlen(snippet));
+    }
+    return buffer;
+}
+
+static double bench_lex(struct buffer *input, int iterations, bool parallel)
+{
+    double start = bench_now();
+    for (int i = 0; i < iterations; i++)
+    {
+        struct compile_process *compiler = compile_process_create_from_buffer(buffer_ptr(input), input->len, NULL, 0);
+        struct lex_process *lex_process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+        if (parallel)
+        {
+            lex_parallel(lex_process, 0);
+        }
+        else
+        {
+            lex(lex_process);
+        }
+        lex_process_free(lex_process);
+    }
+
+    return (double)input->len * iterations / (bench_now() - start);
+}
+
+static double bench_compile(struct buffer *input, int iterations, int flags)
+{
+    double start = bench_now();
+    for (int i = 0; i < iterations; i++)
+    {
+        compile_buffer(buffer_ptr(input), input->len, NULL, flags);
+    }
+
+    return (double)input->len * iterations / (bench_now() - start);
+}
+
+int main(int argc, char **argv)
+{
+    const char *filename = argc > 1 ? argv[1] : NULL;
+    struct buffer *input = bench_input(filename, bench_snippet, 1024 * 1024);
+    if (!input)
+    {
+        printf("Unable to read %s\n", filename);
+        return 1;
+    }
+
+    printf("lex: %.1f MB/s over %i bytes\n", bench_lex(input, 5, false) / (1024 * 1024), input->len);
+    printf("lex_parallel: %.1f MB/s\n", bench_lex(input, 5, true) / (1024 * 1024));
+
+    struct buffer *compile_input = bench_input(NULL, bench_compile_snippet, 1024 * 1024);
+    printf("compile: %.1f MB/s over %i bytes\n", bench_compile(compile_input, 5, 0) / (1024 * 1024), compile_input->len);
+    printf("compile streamed: %.1f MB/s\n", bench_compile(compile_input, 5, COMPILE_PROCESS_FLAG_STREAM_TOKENS) / (1024 * 1024));
+    printf("compile threaded: %.1f MB/s\n", bench_compile(compile_input, 5, COMPILE_PROCESS_FLAG_THREADED_LEX) / (1024 * 1024));
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Generated by tools/keywordgen.c from keywords.list, do not edit
+#include <string.h>
+#include "keywords.h"
+
+#define KEYWORD_HASH_SEED 7
+#define KEYWORD_HASH_MASK 127
+
+struct keyword_slot
+{
+    const char *str;
+    size_t len;
+    int keyword;
+};
+
+static const struct keyword_slot keyword_slots[KEYWORD_HASH_MASK + 1] = {
+    [0] = {"__ignore_typecheck", 18, KEYWORD___IGNORE_TYPECHECK},
+    [9] = {"int", 3, KEYWORD_INT},
+    [16] = {"long", 4, KEYWORD_LONG},
+    [17] = {"for", 3, KEYWORD_FOR},
+    [21] = {"float", 5, KEYWORD_FLOAT},
+    [27] = {"double", 6, KEYWORD_DOUBLE},
+    [30] = {"return", 6, KEYWORD_RETURN},
+    [33] = {"const", 5, KEYWORD_CONST},
+    [41] = {"case", 4, KEYWORD_CASE},
+    [45] = {"short", 5, KEYWORD_SHORT},
+    [56] = {"unsigned", 8, KEYWORD_UNSIGNED},
+    [57] = {"static", 6, KEYWORD_STATIC},
+    [59] = {"else", 4, KEYWORD_ELSE},
+    [60] = {"switch", 6, KEYWORD_SWITCH},
+    [62] = {"if", 2, KEYWORD_IF},
+    [63] = {"do", 2, KEYWORD_DO},
+    [64] = {"signed", 6, KEYWORD_SIGNED},
+    [66] = {"while", 5, KEYWORD_WHILE},
+    [70] = {"continue", 8, KEYWORD_CONTINUE},
+    [71] = {"break", 5, KEYWORD_BREAK},
+    [74] = {"restrict", 8, KEYWORD_RESTRICT},
+    [75] = {"typedef", 7, KEYWORD_TYPEDEF},
+    [83] = {"sizeof", 6, KEYWORD_SIZEOF},
+    [105] = {"struct", 6, KEYWORD_STRUCT},
+    [107] = {"default", 7, KEYWORD_DEFAULT},
+    [108] = {"extern", 6, KEYWORD_EXTERN},
+    [114] = {"goto", 4, KEYWORD_GOTO},
+    [119] = {"char", 4, KEYWORD_CHAR},
+    [121] = {"void", 4, KEYWORD_VOID},
+    [125] = {"union", 5, KEYWORD_UNION},
+    [127] = {"include", 7, KEYWORD_INCLUDE},
+};
+
+static const char *keyword_strings[TOTAL_KEYWORDS + 1] = {
+    [KEYWORD_UNSIGNED] = "unsigned",
+    [KEYWORD_SIGNED] = "signed",
+    [KEYWORD_CHAR] = "char",
+    [KEYWORD_SHORT] = "short",
+    [KEYWORD_INT] = "int",
+    [KEYWORD_LONG] = "long",
+    [KEYWORD_FLOAT] = "float",
+    [KEYWORD_DOUBLE] = "double",
+    [KEYWORD_VOID] = "void",
+    [KEYWORD_STRUCT] = "struct",
+    [KEYWORD_UNION] = "union",
+    [KEYWORD_STATIC] = "static",
+    [KEYWORD___IGNORE_TYPECHECK] = "__ignore_typecheck",
+    [KEYWORD_RETURN] = "return",
+    [KEYWORD_INCLUDE] = "include",
+    [KEYWORD_SIZEOF] = "sizeof",
+    [KEYWORD_IF] = "if",
+    [KEYWORD_ELSE] = "else",
+    [KEYWORD_WHILE] = "while",
+    [KEYWORD_FOR] = "for",
+    [KEYWORD_DO] = "do",
+    [KEYWORD_BREAK] = "break",
+    [KEYWORD_CONTINUE] = "continue",
+    [KEYWORD_SWITCH] = "switch",
+    [KEYWORD_CASE] = "case",
+    [KEYWORD_DEFAULT] = "default",
+    [KEYWORD_GOTO] = "goto",
+    [KEYWORD_TYPEDEF] = "typedef",
+    [KEYWORD_CONST] = "const",
+    [KEYWORD_EXTERN] = "extern",
+    [KEYWORD_RESTRICT] = "restrict",
+};
+
+static unsigned int keyword_hash(const char *str, size_t len)
+{
+    unsigned int hash = (unsigned char)str[0] * KEYWORD_HASH_SEED + (unsigned char)str[len - 1] + (unsigned char)str[len / 2] * 31 + len;
+    return (hash ^ (hash >> 7)) & KEYWORD_HASH_MASK;
+}
+
+int keyword_lookup(const char *str, size_t len)
+{
+    if (len == 0)
+    {
+        return KEYWORD_NONE;
+    }
+
+    const struct keyword_slot *slot = &keyword_slots[keyword_hash(str, len)];
+    if (slot->len != len || memcmp(slot->str, str, len) != 0)
+    {
+        return KEYWORD_NONE;
+    }
+
+    return slot->keyword;
+}
+
+const char *keyword_string(int keyword)
+{
+    return keyword_strings[keyword];
+}
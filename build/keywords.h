@@ -0,0 +1,50 @@
+// Generated by tools/keywordgen.c from keywords.list, do not edit
+#ifndef KEYWORDS_H
+#define KEYWORDS_H
+
+#include <stddef.h>
+
+enum
+{
+    KEYWORD_NONE,
+    KEYWORD_UNSIGNED,
+    KEYWORD_SIGNED,
+    KEYWORD_CHAR,
+    KEYWORD_SHORT,
+    KEYWORD_INT,
+    KEYWORD_LONG,
+    KEYWORD_FLOAT,
+    KEYWORD_DOUBLE,
+    KEYWORD_VOID,
+    KEYWORD_STRUCT,
+    KEYWORD_UNION,
+    KEYWORD_STATIC,
+    KEYWORD___IGNORE_TYPECHECK,
+    KEYWORD_RETURN,
+    KEYWORD_INCLUDE,
+    KEYWORD_SIZEOF,
+    KEYWORD_IF,
+    KEYWORD_ELSE,
+    KEYWORD_WHILE,
+    KEYWORD_FOR,
+    KEYWORD_DO,
+    KEYWORD_BREAK,
+    KEYWORD_CONTINUE,
+    KEYWORD_SWITCH,
+    KEYWORD_CASE,
+    KEYWORD_DEFAULT,
+    KEYWORD_GOTO,
+    KEYWORD_TYPEDEF,
+    KEYWORD_CONST,
+    KEYWORD_EXTERN,
+    KEYWORD_RESTRICT,
+    TOTAL_KEYWORDS = 31
+};
+
+/**
+ * Returns the KEYWORD_ value of the given string or KEYWORD_NONE when it isn't a keyword
+ */
+int keyword_lookup(const char *str, size_t len);
+const char *keyword_string(int keyword);
+
+#endif
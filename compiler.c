@@ -5,25 +5,64 @@
 struct lex_process_functions compiler_lex_functions = {
     .next_char = compile_process_next_char,
     .peek_char = compile_process_peek_char,
-    .push_char = compile_process_push_char};
+    .push_char = compile_process_push_char,
+    .peek_span = compile_process_peek_span,
+    .skip_span = compile_process_skip_span};
 
-int compile_file(const char *filename, const char *out_filename, int flags)
+static int compile_process_run(struct compile_process *compile_process)
 {
-
-    struct compile_process *compile_process = compile_process_create(filename, out_filename, flags);
-    if (!compile_process)
-        return COMPILER_FAILED_WITH_ERRORS;
-
     // perform lexical analysis
     struct lex_process *lex_process = lex_process_create(compile_process, &compiler_lex_functions, NULL);
     if (!lex_process)
         return COMPILER_FAILED_WITH_ERRORS;
 
-    if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    struct lex_pipeline *lex_pipeline = NULL;
+    compile_process->tokens = lex_process->tokens;
+    int threaded_flags = COMPILE_PROCESS_FLAG_STREAM_TOKENS | COMPILE_PROCESS_FLAG_THREADED_LEX;
+    if (preprocessor_has_directives(&compile_process->cfile))
+    {
+        // The preprocessor lexes every file itself and fills a store of its own
+        compile_process->tokens = token_store_create(compile_process);
+        if (!(compile_process->flags & COMPILE_PROCESS_FLAG_PARALLEL_LEX) && (compile_process->flags & threaded_flags))
+        {
+            // Streaming can't pull from the preprocessor, it preprocesses on a thread too
+            lex_pipeline = lex_pipeline_start(lex_process, true);
+        }
+        else if (preprocess(lex_process, NULL) != PREPROCESSING_ALL_OK)
+        {
+            return COMPILER_FAILED_WITH_ERRORS;
+        }
+    }
+    else if (compile_process->flags & COMPILE_PROCESS_FLAG_PARALLEL_LEX)
+    {
+        if (lex_parallel(lex_process, 0) != LEXICAL_ANALYSIS_ALL_OK)
+            return COMPILER_FAILED_WITH_ERRORS;
+    }
+    else if (compile_process->flags & COMPILE_PROCESS_FLAG_STREAM_TOKENS)
+    {
+        // The parser lexes as it goes
+        lex_begin(lex_process);
+        compile_process->token_source = lex_process;
+    }
+    else if (compile_process->flags & COMPILE_PROCESS_FLAG_THREADED_LEX)
+    {
+        // The lexer thread keeps its own tokens, the parser fills a store of its own
+        compile_process->tokens = token_store_create(compile_process);
+        lex_pipeline = lex_pipeline_start(lex_process, false);
+    }
+    else if (lex(lex_process) != LEXICAL_ANALYSIS_ALL_OK)
+    {
         return COMPILER_FAILED_WITH_ERRORS;
+    }
 
     // perform parsing
-    if (parse(compile_process) != PARSING_ALL_OKAY)
+    int parse_result = parse(compile_process);
+    if (lex_pipeline)
+    {
+        lex_pipeline_join(lex_pipeline);
+    }
+
+    if (parse_result != PARSING_ALL_OKAY)
     {
         return COMPILER_FAILED_WITH_ERRORS;
     }
@@ -33,13 +72,77 @@ int compile_file(const char *filename, const char *out_filename, int flags)
     return COMPILER_FILE_COMPILED_OK;
 }
 
+int compile_file(const char *filename, const char *out_filename, int flags)
+{
+    return compile_file_with_include_dirs(filename, out_filename, flags, NULL);
+}
+
+// include_dirs are searched for headers before the default directories, like -I. NULL or
+// ended by NULL
+int compile_file_with_include_dirs(const char *filename, const char *out_filename, int flags, const char **include_dirs)
+{
+    struct compile_process *compile_process = compile_process_create(filename, out_filename, flags);
+    if (!compile_process)
+        return COMPILER_FAILED_WITH_ERRORS;
+
+    for (int i = 0; include_dirs && include_dirs[i]; i++)
+    {
+        compile_process_add_include_dir(compile_process, include_dirs[i]);
+    }
+    return compile_process_run(compile_process);
+}
+
+int compile_buffer(const char *data, size_t size, FILE *out_file, int flags)
+{
+    struct compile_process *compile_process = compile_process_create_from_buffer(data, size, out_file, flags);
+    if (!compile_process)
+        return COMPILER_FAILED_WITH_ERRORS;
+
+    return compile_process_run(compile_process);
+}
+
+// Set on threads whose errors are handed to another thread, see compiler_catch_errors
+static _Thread_local struct compile_error *compiler_caught_error;
+// Offset into the input the errors and warnings of the thread point at. The lexer and the
+// parser of a compile report errors from threads of their own
+static _Thread_local size_t compiler_diagnostic_offset;
+
+// Errors of the calling thread are kept in error from now on, or end the compile again
+// when it is NULL. The caller must have set error->caught with setjmp
+void compiler_catch_errors(struct compile_error *error)
+{
+    compiler_caught_error = error;
+}
+
+// Errors and warnings the calling thread reports from now on point at offset
+void compiler_set_diagnostic_offset(size_t offset)
+{
+    compiler_diagnostic_offset = offset;
+}
+
 void compiler_error(struct compile_process *compiler, const char *message, ...)
 {
     va_list args;
+    if (compiler_caught_error)
+    {
+        struct compile_error *error = compiler_caught_error;
+        va_start(args, message);
+        int length = vsnprintf(NULL, 0, message, args);
+        va_end(args);
+
+        error->message = malloc(length + 1);
+        va_start(args, message);
+        vsnprintf(error->message, length + 1, message, args);
+        va_end(args);
+        error->offset = compiler_diagnostic_offset;
+        longjmp(error->caught, 1);
+    }
+
     va_start(args, message);
     vfprintf(stderr, message, args);
     va_end(args);
-    fprintf(stderr, " on line %i, col %i in file %s\n", compiler->pos.line, compiler->pos.column, compiler->pos.filename);
+    struct position pos = compile_process_position(compiler, compiler_diagnostic_offset);
+    fprintf(stderr, " on line %i, col %i in file %s\n", pos.line, pos.column, pos.filename);
     exit(-1);
 }
 
@@ -49,5 +152,6 @@ void compiler_warning(struct compile_process *compiler, const char *message, ...
     va_start(args, message);
     vfprintf(stderr, message, args);
     va_end(args);
-    fprintf(stderr, " on line %i, col %i in file %s\n", compiler->pos.line, compiler->pos.column, compiler->pos.filename);
+    struct position pos = compile_process_position(compiler, compiler_diagnostic_offset);
+    fprintf(stderr, " on line %i, col %i in file %s\n", pos.line, pos.column, pos.filename);
 }
\ No newline at end of file
@@ -4,37 +4,102 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+#include <stdatomic.h>
+#include "build/keywords.h"
+
+// Part of the key of cached tokens, change it whenever the lexer's output changes
+#define COMPILER_VERSION "0.1.0"
 
 struct token;
 struct position;
 struct compile_process;
 struct lex_process;
 struct lex_process_functions;
+struct lex_edit;
+struct token_store;
+struct token_ring;
+struct compile_error;
+struct lex_pipeline;
+struct vector;
 struct node;
 
 int compile_file(const char *filename, const char *out_filename, int file);
+int compile_file_with_include_dirs(const char *filename, const char *out_filename, int flags, const char **include_dirs);
+int compile_buffer(const char *data, size_t size, FILE *out_file, int flags);
 void compiler_error(struct compile_process *compiler, const char *message, ...);
 void compiler_warning(struct compile_process *compiler, const char *message, ...);
+void compiler_catch_errors(struct compile_error *error);
+void compiler_set_diagnostic_offset(size_t offset);
 struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags);
+struct compile_process *compile_process_create_from_buffer(const char *data, size_t size, FILE *out_file, int flags);
+void compile_process_add_include_dir(struct compile_process *process, const char *dir);
 char compile_process_next_char(struct lex_process *lex_process);
 char compile_process_peek_char(struct lex_process *lex_process);
 void compile_process_push_char(struct lex_process *lex_process, char c);
 
+struct lex_process_span compile_process_peek_span(struct lex_process *lex_process, size_t min);
+void compile_process_skip_span(struct lex_process *lex_process, size_t amount);
+struct position compile_process_position(struct compile_process *compiler, size_t offset);
+const char *compile_process_text(struct compile_process *compiler, size_t offset);
+struct compile_process_input_file *compile_process_include_file(struct compile_process *compiler, const char *path);
+
 struct lex_process *lex_process_create(struct compile_process *compiler, struct lex_process_functions *functions, void *private);
 void lex_process_free(struct lex_process *process);
 void *lex_process_private(struct lex_process *process);
-struct vector *lex_process_tokens(struct lex_process *process);
+struct token_store *lex_process_tokens(struct lex_process *process);
+struct lex_process_span lex_process_peek_span(struct lex_process *process, size_t min);
+void lex_process_skip_span(struct lex_process *process, size_t amount);
 int lex(struct lex_process *process);
-
-bool is_token_keyword(struct token *token, const char *value);
+void lex_begin(struct lex_process *process);
+struct token *lex_next_token(struct lex_process *process);
+void lex_end(struct lex_process *process);
+void lex_skip_input(struct lex_process *process, size_t amount);
+int lex_operator_lookup(const char *str);
+int lex_parallel(struct lex_process *process, int threads);
+int lex_incremental(struct lex_process *process, struct token_store *old_tokens, struct lex_edit *edits, int total_edits);
+struct lex_pipeline *lex_pipeline_start(struct lex_process *process, bool preprocess);
+void lex_pipeline_join(struct lex_pipeline *pipeline);
+bool preprocessor_has_directives(struct compile_process_input_file *input);
+int preprocess(struct lex_process *process, struct token_ring *ring);
+bool preprocessor_lex_ahead(struct lex_process *process, struct compile_process_input_file *input);
+const char *header_search_find(const char *name, const char *including_file, struct vector *dirs);
+const void *header_cache_file(const char *path, const void *(*load)(void *data), void *data);
+const void *header_cache_find(uint64_t content_hash, const void *(*load)(void *data), void *data);
+void token_cache_set_directory(const char *dir);
+uint64_t token_cache_hash(const char *data, size_t size);
+bool token_cache_fill(struct lex_process *process);
+
+bool is_token_keyword(struct token *token, int keyword);
 bool token_is_comment_newline_or_newline_seperator(struct token *token);
 bool token_is_symbol(struct token *token, char c);
+const char *token_between_brackets(struct compile_process *process, struct token *token);
+
+struct token_store *token_store_create(struct compile_process *compiler);
+void token_store_free(struct token_store *store);
+int token_store_push(struct token_store *store, struct token *token);
+void token_store_pop(struct token_store *store);
+void token_store_read(struct token_store *store, int index, struct token *token);
+void token_store_append(struct token_store *store, struct token_store *other, int start, int end, size_t offset_delta);
+void token_store_splice(struct token_store *store, int start, int end, struct token_store *other, int other_start, int other_end, size_t offset_delta);
+void token_store_set_whitespace(struct token_store *store, int index, bool whitespace);
+void token_store_clear(struct token_store *store);
+void token_store_discard(struct token_store *store, int total);
+void token_store_close_span(struct token_store *store, size_t offset, size_t end_offset);
+struct position token_store_position(struct token_store *store, int index);
+
+struct token_ring *token_ring_create(size_t capacity);
+void token_ring_free(struct token_ring *ring);
+void token_ring_push(struct token_ring *ring, struct token *token);
+void token_ring_close(struct token_ring *ring);
+bool token_ring_pop(struct token_ring *ring, struct token *token);
 static struct token *token_next();
 static struct token *token_peek_next();
 
 int parse(struct compile_process *process);
 void parse_single_token_to_node();
-static void parser_ignore_comment_or_newline(struct token *token);
+static void parser_ignore_comment_or_newline();
 
 void node_set_vector(struct vector *vector, struct vector *vector_root);
 void node_push(struct node *node);
@@ -44,7 +109,33 @@ struct node *node_pop();
 struct node *node_create(struct node *_node);
 bool node_is_expressionable(struct node *node);
 struct node *node_peek_expressionable_or_null();
-void node_make_expression(struct node *left, struct node *right, const char *operator);
+void node_make_expression(struct node *left, struct node *right, const char *operator, int op);
+void expressionable_init();
+
+// Inputs with a line starting with a directive are preprocessed. The preprocessor lexes
+// included headers serially whatever the flags say, the flags pick how the input itself
+// is lexed and how the output reaches the parser
+enum
+{
+    // Lex large inputs on several threads, the tokens are the same as lexing serially
+    COMPILE_PROCESS_FLAG_PARALLEL_LEX = 0b00000001,
+    // Lex while parsing, the parser pulls tokens as it needs them and the ones it has
+    // read are dropped. The preprocessor can't be pulled from a token at a time, so an
+    // input with directives is preprocessed on a thread of its own as with
+    // COMPILE_PROCESS_FLAG_THREADED_LEX. Ignored with COMPILE_PROCESS_FLAG_PARALLEL_LEX
+    COMPILE_PROCESS_FLAG_STREAM_TOKENS = 0b00000010,
+    // Lex, or preprocess, on a thread of its own while parsing, tokens are handed over
+    // through a token_ring. Ignored with COMPILE_PROCESS_FLAG_PARALLEL_LEX
+    COMPILE_PROCESS_FLAG_THREADED_LEX = 0b00000100,
+    // Keep the tokens of included headers in the token cache directory, later compiles
+    // map them from there instead of lexing the headers again
+    COMPILE_PROCESS_FLAG_TOKEN_CACHE = 0b00001000,
+    // Share the contents and tokens of included headers with every other compile of the
+    // process that sets it, a header is only read and lexed by the first compile that
+    // includes it. Compiles on several threads at once go all the way, the parser keeps
+    // its state per thread
+    COMPILE_PROCESS_FLAG_SHARED_HEADERS = 0b00010000
+};
 
 enum
 {
@@ -58,6 +149,12 @@ enum
     LEXICAL_ANALYSIS_INPUT_ERROR
 };
 
+enum
+{
+    PREPROCESSING_ALL_OK,
+    PREPROCESSING_INPUT_ERROR
+};
+
 enum
 {
     PARSING_ALL_OKAY,
@@ -76,6 +173,83 @@ enum
     TOKEN_TYPE_NEWLINE
 };
 
+// flags of number tokens, taken from the constant's suffix. Floating constants hold their
+// value in dval, long double ones too
+enum
+{
+    NUMBER_FLAG_UNSIGNED = 0b00000001,
+    NUMBER_FLAG_LONG = 0b00000010,
+    NUMBER_FLAG_LONG_LONG = 0b00000100,
+    NUMBER_FLAG_FLOATING = 0b00001000,
+    NUMBER_FLAG_FLOAT = 0b00010000
+};
+
+// Entries of the lexer's character class table. The low bits say which kind of token a
+// character starts, the remaining bits are predicates tested while scanning a token
+enum
+{
+    LEX_CHAR_START_INVALID,
+    LEX_CHAR_START_NUMBER,
+    LEX_CHAR_START_OPERATOR,
+    LEX_CHAR_START_SYMBOL,
+    LEX_CHAR_START_STRING,
+    LEX_CHAR_START_QUOTE,
+    LEX_CHAR_START_WHITESPACE,
+    LEX_CHAR_START_NEWLINE,
+    LEX_CHAR_START_IDENTIFIER,
+    LEX_CHAR_START_MASK = 0x000f,
+
+    LEX_CHAR_DIGIT = 0x0010,
+    LEX_CHAR_HEX = 0x0020,
+    LEX_CHAR_IDENTIFIER = 0x0040
+};
+
+enum
+{
+    OPERATOR_NONE,
+    OPERATOR_PLUS,
+    OPERATOR_MINUS,
+    OPERATOR_MULTIPLY,
+    OPERATOR_DIVIDE,
+    OPERATOR_MODULO,
+    OPERATOR_LOGICAL_NOT,
+    OPERATOR_BITWISE_XOR,
+    OPERATOR_BITWISE_NOT,
+    OPERATOR_BITWISE_AND,
+    OPERATOR_BITWISE_OR,
+    OPERATOR_LOGICAL_AND,
+    OPERATOR_LOGICAL_OR,
+    OPERATOR_LEFT_SHIFT,
+    OPERATOR_RIGHT_SHIFT,
+    OPERATOR_LESS,
+    OPERATOR_LESS_EQUAL,
+    OPERATOR_GREATER,
+    OPERATOR_GREATER_EQUAL,
+    OPERATOR_EQUAL,
+    OPERATOR_NOT_EQUAL,
+    OPERATOR_ASSIGN,
+    OPERATOR_ADD_ASSIGN,
+    OPERATOR_SUBTRACT_ASSIGN,
+    OPERATOR_MULTIPLY_ASSIGN,
+    OPERATOR_DIVIDE_ASSIGN,
+    OPERATOR_MODULO_ASSIGN,
+    OPERATOR_LEFT_SHIFT_ASSIGN,
+    OPERATOR_RIGHT_SHIFT_ASSIGN,
+    OPERATOR_AND_ASSIGN,
+    OPERATOR_XOR_ASSIGN,
+    OPERATOR_OR_ASSIGN,
+    OPERATOR_INCREMENT,
+    OPERATOR_DECREMENT,
+    OPERATOR_ARROW,
+    OPERATOR_LEFT_PARENTHESIS,
+    OPERATOR_LEFT_BRACKET,
+    OPERATOR_COMMA,
+    OPERATOR_DOT,
+    OPERATOR_ELLIPSIS,
+    OPERATOR_QUESTION,
+    TOTAL_OPERATORS
+};
+
 enum
 {
     NODE_TYPE_EXPRESSION,
@@ -124,46 +298,11 @@ enum
 #define S_EQ(string1, string2) \
     string1 &&string2 && (strcmp(string1, string2) == 0)
 
-#define NUMERIC_CASE \
-    case '0':        \
-    case '1':        \
-    case '2':        \
-    case '3':        \
-    case '4':        \
-    case '5':        \
-    case '6':        \
-    case '7':        \
-    case '8':        \
-    case '9'
-
-#define OPERATOR_CASE_EXCLUDING_DIVISION \
-    case '+':                            \
-    case '-':                            \
-    case '*':                            \
-    case '>':                            \
-    case '<':                            \
-    case '^':                            \
-    case '%':                            \
-    case '!':                            \
-    case '=':                            \
-    case '~':                            \
-    case '|':                            \
-    case '&':                            \
-    case '(':                            \
-    case '[':                            \
-    case ',':                            \
-    case '.':                            \
-    case '?'
-
-#define SYMBOL_CASE \
-    case '{':       \
-    case '}':       \
-    case '#':       \
-    case ':':       \
-    case ';':       \
-    case ']':       \
-    case ')':       \
-    case '\\'
+// Largest span the lexer will ever request from a source in one go
+#define LEX_PROCESS_LOOKAHEAD_SIZE 8
+
+#define MAX_OPERATOR_LENGTH 3
+#define MAX_OPERATOR_STATES 64
 
 #define TOTAL_OPERATOR_GROUPS 14
 #define MAX_OPERATORS_IN_GROUP 12
@@ -172,6 +311,18 @@ typedef char (*LEX_PROCESS_NEXT_CHAR)(struct lex_process *process);
 typedef char (*LEX_PROCESS_PEEK_CHAR)(struct lex_process *process);
 typedef void (*LEX_PROCESS_PUSH_CHAR)(struct lex_process *process, char c);
 
+struct lex_process_span
+{
+    const char *ptr;
+    size_t len;
+};
+
+// Returns unread input as one contiguous span, at least min characters of it unless the
+// input ends first. The span may end before the input does, the lexer peeks again once it
+// has skipped past it. An empty span means end of input
+typedef struct lex_process_span (*LEX_PROCESS_PEEK_SPAN)(struct lex_process *process, size_t min);
+typedef void (*LEX_PROCESS_SKIP_SPAN)(struct lex_process *process, size_t amount);
+
 struct position
 {
     int line;
@@ -183,7 +334,17 @@ struct token
 {
     int type;
     int flags;
-    struct position pos;
+    // Where the token's text starts in the input and how long it is
+    size_t offset;
+    size_t length;
+
+    union
+    {
+        // The KEYWORD_ value of keyword tokens
+        int keyword;
+        // The OPERATOR_ value of operator tokens
+        int op;
+    };
 
     union
     {
@@ -192,12 +353,21 @@ struct token
         unsigned int inum;
         unsigned long lnum;
         unsigned long long llnum;
+        double dval;
         void *any;
     };
 
     // True if there is a white space between the current token and next token
     bool whitespace;
-    const char *between_brackets;
+
+    // The source text between the outermost brackets this token is inside of, as an offset
+    // and length into the input. The length is 0 outside of brackets, token_between_brackets
+    // builds the text
+    struct token_span
+    {
+        size_t offset;
+        size_t length;
+    } between_brackets;
 };
 
 struct node
@@ -228,46 +398,207 @@ struct node
             struct node *left;
             struct node *right;
             const char *operator;
+            // The OPERATOR_ value of the operator
+            int op;
         } expression;
     };
 };
 
+// An included header as every compile sharing headers reads it, kept by the header cache
+struct compile_process_shared_file
+{
+    const char *data;
+    size_t size;
+    uint64_t content_hash;
+};
+
 struct compile_process
 {
     // The flags to determine how this file should be compiled
     int flags;
-    struct position pos;
 
     struct compile_process_input_file
     {
         FILE *fp;
         const char *abs_path;
+
+        // The whole input, memory mapped when possible and read into the heap otherwise.
+        // index is the next character to be read
+        const char *data;
+        size_t size;
+        size_t index;
+        // Whether data is mapped, it's on the heap otherwise
+        bool mapped;
+
+        // Tokens of included files have offsets past the main input and every file
+        // included before, base is the offset the file starts at
+        size_t base;
+        // Offset of the first character of every line, built when a position is first needed
+        uint32_t *line_starts;
+        size_t total_lines;
+
+        // Contents read once for every compile of the process, with
+        // COMPILE_PROCESS_FLAG_SHARED_HEADERS. NULL for inputs of this compile alone
+        const struct compile_process_shared_file *shared;
     } cfile;
 
-    struct vector *token_vec;
+    // struct compile_process_input_file * of every file included, by base
+    struct vector *included_files;
+    // const char * of the directories <> includes are looked for in, and "" ones that
+    // aren't next to the including file, in order. The ones added for the compile come
+    // before the default ones
+    struct vector *include_dirs;
+    int total_added_include_dirs;
+
+    // Identifiers, keywords and operators are interned here, equal lexemes share one pointer
+    struct intern_table *interned;
+    // Text of string and comment tokens
+    struct arena *lexemes;
+
+    // Interned text of every operator and keyword, so their tokens never hash them again
+    const char *operators[TOTAL_OPERATORS];
+    const char *keywords[TOTAL_KEYWORDS + 1];
+
+    struct token_store *tokens;
+    // Set while tokens are streamed, the lex process tokens are pulled out of. The
+    // between_brackets length of a token is only known once its bracket is closed
+    struct lex_process *token_source;
+    // Set while a lexer thread hands tokens over, the parser pops them from here
+    struct token_ring *token_ring;
     struct vector *node_vec;
     struct vector *node_tree_vec;
 
     FILE *ofile;
 };
 
+// Token kinds in a token_store carry this bit when blanks follow the token
+#define TOKEN_STORE_WHITESPACE 0x80
+#define TOKEN_STORE_KIND_MASK 0x7f
+
+// The tokens of an input kept as parallel arrays, so going over the tokens only touches
+// the arrays that are read. Positions are kept as offsets into the input, lines and
+// columns are worked out when something asks for them
+struct token_store
+{
+    struct compile_process *compiler;
+    int count;
+    int capacity;
+
+    // TOKEN_TYPE_ of every token, with TOKEN_STORE_WHITESPACE
+    unsigned char *kinds;
+    // The token's flags, NUMBER_FLAG_ for numbers
+    unsigned char *flags;
+    uint32_t *offsets;
+    uint32_t *lengths;
+    // Index into values for numbers, identifiers, strings and comments. The KEYWORD_ or
+    // OPERATOR_ value of keywords and operators, and the character of symbols
+    uint32_t *payloads;
+    // One more than the index into spans of the outermost brackets the token is inside
+    // of, 0 outside of brackets
+    uint32_t *brackets;
+
+    unsigned long long *values;
+    int total_values;
+    int values_capacity;
+
+    struct token_span *spans;
+    int total_spans;
+    int spans_capacity;
+
+    // The token arrays and spans are part of a token cache image, mapped from its file or
+    // shared by the compiles of the process. They are read only and never grown or freed
+    bool mapped;
+};
+
+// Hands tokens from one thread to another without locks. Only one thread pushes and only
+// one pops. head and tail count every token ever popped and pushed, masked they index
+// tokens. Each side keeps its last look at the other side's count on its own cache line,
+// so the shared counts are only read when that look runs out
+struct token_ring
+{
+    struct token *tokens;
+    size_t mask;
+
+    _Alignas(64) _Atomic size_t head;
+    size_t consumer_tail;
+
+    _Alignas(64) _Atomic size_t tail;
+    size_t producer_head;
+    // Set once the last token is pushed
+    _Atomic bool closed;
+    // Set before the ring is closed when the pushing side stopped on an error, the popping
+    // side reports it once it has popped every token pushed before it
+    struct compile_error *error;
+};
+
+// Where a thread that works for a compile running on another thread keeps its error. The
+// thread jumps to caught instead of ending the compile
+struct compile_error
+{
+    jmp_buf caught;
+    char *message;
+    // Offset into the inputs the error points at
+    size_t offset;
+};
+
+// A range of the previous input that was replaced, for lex_incremental
+struct lex_edit
+{
+    // Where the replaced characters start in the previous input, and how many there were
+    size_t offset;
+    size_t old_length;
+    // Amount of characters that replaced them
+    size_t new_length;
+};
+
 struct lex_process_functions
 {
     LEX_PROCESS_NEXT_CHAR next_char;
     LEX_PROCESS_PEEK_CHAR peek_char;
     LEX_PROCESS_PUSH_CHAR push_char;
+
+    // Optional, sources that keep their input in memory hand it to the lexer in spans. A
+    // source read in chunks ends a span where its chunk does, as long as min characters
+    // are left in it. When these are NULL the lexer builds spans out of the single
+    // character callbacks
+    LEX_PROCESS_PEEK_SPAN peek_span;
+    LEX_PROCESS_SKIP_SPAN skip_span;
 };
 
 struct lex_process
 {
-    struct position pos;
-    struct vector *token_vec;
+    struct token_store *tokens;
     struct compile_process *compiler;
 
+    // Amount of input consumed so far
+    size_t offset;
+    // Where the input starts among the inputs of the compile process. Tokens have offsets
+    // into the input alone, errors are reported with this added
+    size_t base;
+    // Offset the token being read starts at
+    size_t token_offset;
+
     int current_expression_count;
-    struct buffer *parentheses_buffer;
+    // Offset of the text inside the outermost open bracket
+    size_t expression_offset;
+    // Scratch space for lexemes that have to be gathered before they are stored
+    struct buffer *lexeme_buffer;
+    // Text of string and comment tokens, the compile process's arena unless lexing in parallel
+    struct arena *lexemes;
     struct lex_process_functions *function;
 
+    // Characters read ahead through next_char for sources without span callbacks
+    char lookahead[LEX_PROCESS_LOOKAHEAD_SIZE];
+    size_t lookahead_len;
+
+    // Set while lexing speculatively from the middle of the input, errors jump here
+    // instead of ending the compile
+    jmp_buf *speculation_failed;
+    // Blanks came before the first token, there was no token to mark with them
+    bool leading_whitespace;
+    // A closing bracket was let through while speculating, see lex_finish_expression
+    bool unmatched_close;
+
     // This is private data that lexer doesn't understand but the person using the lexer does
     void *private;
 };
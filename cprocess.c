@@ -1,7 +1,108 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "compiler.h"
 #include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include "helpers/intern.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
+
+static bool compile_process_map_input(struct compile_process_input_file *file)
+{
+    struct stat st;
+    if (fstat(fileno(file->fp), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+    {
+        return false;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file->fp), 0);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    file->data = data;
+    file->size = st.st_size;
+    file->mapped = true;
+    return true;
+}
+
+static void compile_process_read_input(struct compile_process_input_file *file)
+{
+    // Pipes, devices and empty files can't be mapped so they are read into the heap instead
+    struct buffer *buffer = buffer_create();
+    char chunk[4096];
+    size_t amount = 0;
+    while ((amount = fread(chunk, 1, sizeof(chunk), file->fp)) > 0)
+    {
+        buffer_write_bytes(buffer, chunk, amount);
+    }
+
+    file->data = buffer_ptr(buffer);
+    file->size = buffer->len;
+    free(buffer);
+}
+
+static void compile_process_load_input(struct compile_process_input_file *file)
+{
+    if (!compile_process_map_input(file))
+    {
+        compile_process_read_input(file);
+    }
+}
+
+// Unmaps or frees the contents of an input loaded by this compile and closes it
+static void compile_process_unload_input(struct compile_process_input_file *file)
+{
+    if (file->mapped)
+    {
+        munmap((void *)file->data, file->size);
+    }
+    else
+    {
+        free((void *)file->data);
+    }
+    fclose(file->fp);
+}
+
+#ifndef COMPILE_PROCESS_MULTIARCH
+#define COMPILE_PROCESS_MULTIARCH ""
+#endif
+
+// Searched after the directories added for the compile, in the order gcc searches them.
+// The multiarch directory is left out on hosts without one
+static const char *compile_process_default_include_dirs[] = {"/usr/local/include", "/usr/include/" COMPILE_PROCESS_MULTIARCH, "/usr/include", NULL};
+
+static struct vector *compile_process_include_dirs()
+{
+    struct vector *dirs = vector_create(sizeof(const char *));
+    for (int i = 0; compile_process_default_include_dirs[i]; i++)
+    {
+        if (i != 1 || *COMPILE_PROCESS_MULTIARCH)
+        {
+            vector_push(dirs, &compile_process_default_include_dirs[i]);
+        }
+    }
+    return dirs;
+}
+
+static struct compile_process *compile_process_new(FILE *out_file, int flags)
+{
+    expressionable_init();
+    struct compile_process *process = calloc(1, sizeof(struct compile_process));
+    process->node_vec = vector_create(sizeof(struct node *));
+    process->node_tree_vec = vector_create(sizeof(struct node *));
+    process->included_files = vector_create(sizeof(struct compile_process_input_file *));
+    process->include_dirs = compile_process_include_dirs();
+    process->interned = intern_table_create();
+    process->lexemes = arena_create();
+    process->flags = flags;
+    process->ofile = out_file;
+    return process;
+}
 
 struct compile_process *compile_process_create(const char *filename, const char *filename_out, int flags)
 {
@@ -17,44 +118,242 @@ struct compile_process *compile_process_create(const char *filename, const char
         out_file = fopen(filename_out, "w");
         if (!out_file)
         {
+            fclose(file);
             return NULL;
         }
     }
 
-    struct compile_process *process = calloc(1, sizeof(struct compile_process));
-    process->node_vec = vector_create(sizeof(struct node *));
-    process->node_tree_vec = vector_create(sizeof(struct node *));
-    process->flags = flags;
+    struct compile_process *process = compile_process_new(out_file, flags);
     process->cfile.fp = file;
-    process->ofile = out_file;
+    process->cfile.abs_path = filename;
+    compile_process_load_input(&process->cfile);
+
+    // Tokens keep 32 bit offsets into the input
+    if (process->cfile.size > UINT32_MAX)
+    {
+        compile_process_unload_input(&process->cfile);
+        if (out_file)
+        {
+            fclose(out_file);
+        }
+        vector_free(process->node_vec);
+        vector_free(process->node_tree_vec);
+        vector_free(process->included_files);
+        vector_free(process->include_dirs);
+        intern_table_free(process->interned);
+        arena_free(process->lexemes);
+        free(process);
+        return NULL;
+    }
     return process;
 }
 
-char compile_process_next_char(struct lex_process *lex_process)
+// The buffer is not copied, it must stay alive and unchanged until compilation is done.
+// out_file is optional and may be an in-memory stream such as one from open_memstream
+struct compile_process *compile_process_create_from_buffer(const char *data, size_t size, FILE *out_file, int flags)
+{
+    if (size > UINT32_MAX)
+    {
+        return NULL;
+    }
+
+    struct compile_process *process = compile_process_new(out_file, flags);
+    process->cfile.data = data;
+    process->cfile.size = size;
+    return process;
+}
+
+// Adds a directory to look for headers in, like -I. It's searched after the directories
+// added before it and before the default ones. dir must stay alive for the compile
+void compile_process_add_include_dir(struct compile_process *process, const char *dir)
+{
+    vector_push_at(process->include_dirs, process->total_added_include_dirs++, &dir);
+}
+
+// Reads a header for the header cache, the file isn't kept open. Its contents stay for as
+// long as the process
+static const void *compile_process_read_shared(void *data)
+{
+    struct compile_process_input_file file = {.fp = fopen(data, "r")};
+    if (!file.fp)
+    {
+        return NULL;
+    }
+
+    compile_process_load_input(&file);
+    fclose(file.fp);
+    struct compile_process_shared_file *shared = malloc(sizeof(struct compile_process_shared_file));
+    shared->data = file.data;
+    shared->size = file.size;
+    shared->content_hash = token_cache_hash(file.data, file.size);
+    return shared;
+}
+
+// Opens a file to be included, its offsets start past the files already read. With
+// COMPILE_PROCESS_FLAG_SHARED_HEADERS a header already read by a compile of the process
+// isn't opened again. Returns NULL when it can't be opened or the offsets would no longer
+// fit in 32 bits
+struct compile_process_input_file *compile_process_include_file(struct compile_process *compiler, const char *path)
 {
-    struct compile_process *compiler = lex_process->compiler;
-    compiler->pos.column += 1;
-    char c = getc(compiler->cfile.fp);
+    const struct compile_process_shared_file *shared = NULL;
+    FILE *fp = NULL;
+    if (compiler->flags & COMPILE_PROCESS_FLAG_SHARED_HEADERS)
+    {
+        shared = header_cache_file(path, compile_process_read_shared, (void *)path);
+    }
+    else
+    {
+        fp = fopen(path, "r");
+    }
 
-    if (c == '\n')
+    if (!shared && !fp)
     {
-        compiler->pos.line += 1;
-        compiler->pos.column = 1;
+        return NULL;
     }
 
-    return c;
+    struct compile_process_input_file *last = vector_empty(compiler->included_files) ? &compiler->cfile : vector_back_ptr(compiler->included_files);
+    struct compile_process_input_file *file = calloc(1, sizeof(struct compile_process_input_file));
+    file->fp = fp;
+    file->abs_path = path;
+    file->shared = shared;
+    // One past the end of the last file, so an offset at its very end still falls in it
+    file->base = last->base + last->size + 1;
+    if (shared)
+    {
+        file->data = shared->data;
+        file->size = shared->size;
+    }
+    else
+    {
+        compile_process_load_input(file);
+    }
+
+    if (file->base + file->size > UINT32_MAX)
+    {
+        // Shared contents stay for the other compiles
+        if (!shared)
+        {
+            compile_process_unload_input(file);
+        }
+        free(file);
+        return NULL;
+    }
+
+    vector_push(compiler->included_files, &file);
+    return file;
+}
+
+// Lex processes read the main input unless their private data is an included file
+static struct compile_process_input_file *compile_process_input(struct lex_process *lex_process)
+{
+    struct compile_process_input_file *file = lex_process_private(lex_process);
+    return file ? file : &lex_process->compiler->cfile;
+}
+
+char compile_process_next_char(struct lex_process *lex_process)
+{
+    struct compile_process_input_file *file = compile_process_input(lex_process);
+    if (file->index >= file->size)
+    {
+        return EOF;
+    }
+
+    return file->data[file->index++];
 }
 
 char compile_process_peek_char(struct lex_process *lex_process)
 {
-    struct compile_process *compiler = lex_process->compiler;
-    char c = getc(compiler->cfile.fp);
-    ungetc(c, compiler->cfile.fp);
-    return c;
+    struct compile_process_input_file *file = compile_process_input(lex_process);
+    return file->index < file->size ? file->data[file->index] : EOF;
 }
 
 void compile_process_push_char(struct lex_process *lex_process, char c)
 {
-    struct compile_process *compiler = lex_process->compiler;
-    ungetc(c, compiler->cfile.fp);
+    struct compile_process_input_file *file = compile_process_input(lex_process);
+    // Only characters that were read can be pushed back, so stepping back is enough
+    if (file->index > 0)
+    {
+        file->index--;
+    }
+}
+
+struct lex_process_span compile_process_peek_span(struct lex_process *lex_process, size_t min)
+{
+    struct compile_process_input_file *file = compile_process_input(lex_process);
+    return (struct lex_process_span){.ptr = &file->data[file->index], .len = file->size - file->index};
+}
+
+// Indexes where every line starts in one pass over the input, the first time a position
+// is asked for
+static void compile_process_index_lines(struct compile_process_input_file *file)
+{
+    size_t newlines = scan.count_newlines(file->data, file->size, NULL);
+    file->line_starts = malloc((newlines + 1) * sizeof(uint32_t));
+    file->line_starts[0] = 0;
+    file->total_lines = scan.find_line_starts(file->data, file->size, &file->line_starts[1]) + 1;
+}
+
+// The input an offset falls in, the main input or one of the included files
+static struct compile_process_input_file *compile_process_input_at(struct compile_process *compiler, size_t offset)
+{
+    struct compile_process_input_file *file = &compiler->cfile;
+    int low = 0;
+    int high = vector_count(compiler->included_files);
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        struct compile_process_input_file *included = vector_peek_ptr_at(compiler->included_files, middle);
+        if (included->base <= offset)
+        {
+            file = included;
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return file;
+}
+
+// Works out the line and column of an offset from the line it falls in
+struct position compile_process_position(struct compile_process *compiler, size_t offset)
+{
+    struct compile_process_input_file *file = compile_process_input_at(compiler, offset);
+    if (!file->line_starts)
+    {
+        compile_process_index_lines(file);
+    }
+
+    offset -= file->base;
+    size_t low = 0;
+    size_t high = file->total_lines;
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+        if (file->line_starts[middle] <= offset)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return (struct position){.line = low + 1, .column = offset - file->line_starts[low] + 1, .filename = file->abs_path};
+}
+
+// The text at an offset, in whichever input it falls in
+const char *compile_process_text(struct compile_process *compiler, size_t offset)
+{
+    struct compile_process_input_file *file = compile_process_input_at(compiler, offset);
+    return &file->data[offset - file->base];
+}
+
+void compile_process_skip_span(struct lex_process *lex_process, size_t amount)
+{
+    struct compile_process_input_file *file = compile_process_input(lex_process);
+    file->index += amount;
 }
@@ -1,3 +1,4 @@
+#include <pthread.h>
 #include "compiler.h"
 
 struct expressionable_operator_precedence_group operator_group[TOTAL_OPERATOR_GROUPS] = {
@@ -15,3 +16,38 @@ struct expressionable_operator_precedence_group operator_group[TOTAL_OPERATOR_GR
     {.operators = {"?", ":", NULL}, .associtivity = ASSOCIATIVITY_RIGHT_TO_LEFT},
     {.operators = {"=", "+=", "-=", "*=", "/=", "%=", "<<=", ">>=", "&=", "^=", "|=", NULL}, .associtivity = ASSOCIATIVITY_RIGHT_TO_LEFT},
     {.operators = {",", NULL}, .associtivity = ASSOCIATIVITY_LEFT_TO_RIGHT}};
+
+// Index into operator_group of every operator by its OPERATOR_ value, lower binds tighter,
+// -1 for operators in no group. Built from operator_group once, by the first compile
+// process created, and read directly from then on
+int operator_precedence[TOTAL_OPERATORS];
+static pthread_once_t operator_precedence_once = PTHREAD_ONCE_INIT;
+
+static void expressionable_build_operator_precedence()
+{
+    for (int op = 0; op < TOTAL_OPERATORS; op++)
+    {
+        operator_precedence[op] = -1;
+    }
+
+    // Entries like "()" and ":" aren't operators the lexer makes, they have no OPERATOR_ value
+    for (int group = 0; group < TOTAL_OPERATOR_GROUPS; group++)
+    {
+        for (int i = 0; operator_group[group].operators[i]; i++)
+        {
+            int op = lex_operator_lookup(operator_group[group].operators[i]);
+            if (op != OPERATOR_NONE && operator_precedence[op] < 0)
+            {
+                operator_precedence[op] = group;
+            }
+        }
+    }
+}
+
+/**
+ * Builds operator_precedence, before anything that reads it can run
+ */
+void expressionable_init()
+{
+    pthread_once(&operator_precedence_once, expressionable_build_operator_precedence);
+}
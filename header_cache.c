@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "compiler.h"
+
+// Power of two, headers are spread over the shards by the hash of their key
+#define HEADER_CACHE_SHARDS 16
+#define HEADER_CACHE_INITIAL_CAPACITY 32
+
+// A header as it was when it was read, keyed by its path, modification time and size. A
+// header that changes gets an entry of its own. Entries without a path are the tokens of
+// contents with a hash, headers with equal contents share them
+struct header_cache_entry
+{
+    char *path;
+    struct timespec mtime;
+    uint64_t size;
+    uint64_t content_hash;
+    uint64_t key_hash;
+
+    // The once flag of the entry. The thread that finds it not loaded loads it with the
+    // lock held, threads that come along meanwhile wait on the lock instead of loading it too
+    pthread_mutex_t lock;
+    _Atomic bool loaded;
+    // What load returned, read only once loaded is set. NULL when it can't be shared
+    const void *value;
+};
+
+// Open addressing over the entries whose key hashes to the shard. Entries are never
+// removed, so an entry stays where it is once it is handed out
+struct header_cache_shard
+{
+    pthread_mutex_t lock;
+    struct header_cache_entry **entries;
+    size_t capacity;
+    size_t count;
+};
+
+static struct header_cache_shard header_cache_shards[HEADER_CACHE_SHARDS];
+static pthread_once_t header_cache_once = PTHREAD_ONCE_INIT;
+
+static void header_cache_init()
+{
+    for (int i = 0; i < HEADER_CACHE_SHARDS; i++)
+    {
+        pthread_mutex_init(&header_cache_shards[i].lock, NULL);
+    }
+}
+
+// Hashes the key of a header's entry, or of the entry of its contents when path is NULL
+static uint64_t header_cache_hash(const char *path, const struct stat *st, uint64_t content_hash)
+{
+    uint64_t hash = content_hash ^ 0xcbf29ce484222325ULL;
+    if (!path)
+    {
+        return hash ^ hash >> 32;
+    }
+
+    for (const char *c = path; *c; c++)
+    {
+        hash = (hash ^ (unsigned char)*c) * 0x100000001b3ULL;
+    }
+
+    hash = (hash ^ (uint64_t)st->st_size) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (uint64_t)st->st_mtim.tv_sec) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ (uint64_t)st->st_mtim.tv_nsec) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ hash >> 32;
+}
+
+static bool header_cache_matches(struct header_cache_entry *entry, uint64_t key_hash, const char *path, const struct stat *st, uint64_t content_hash)
+{
+    if (entry->key_hash != key_hash || !entry->path != !path)
+    {
+        return false;
+    }
+
+    if (!path)
+    {
+        return entry->content_hash == content_hash;
+    }
+
+    return entry->size == (uint64_t)st->st_size && entry->mtime.tv_sec == st->st_mtim.tv_sec &&
+           entry->mtime.tv_nsec == st->st_mtim.tv_nsec && S_EQ(entry->path, path);
+}
+
+static void header_cache_grow(struct header_cache_shard *shard)
+{
+    struct header_cache_entry **old_entries = shard->entries;
+    size_t old_capacity = shard->capacity;
+    shard->capacity = old_capacity ? old_capacity * 2 : HEADER_CACHE_INITIAL_CAPACITY;
+    shard->entries = calloc(shard->capacity, sizeof(struct header_cache_entry *));
+
+    size_t mask = shard->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_entries[i])
+        {
+            continue;
+        }
+
+        // The low bits picked the shard, the slot is picked by the high ones
+        size_t index = (old_entries[i]->key_hash >> 32) & mask;
+        while (shard->entries[index])
+        {
+            index = (index + 1) & mask;
+        }
+        shard->entries[index] = old_entries[i];
+    }
+    free(old_entries);
+}
+
+// The entry of a key, added when the key hasn't been asked for before
+static struct header_cache_entry *header_cache_entry(const char *path, const struct stat *st, uint64_t content_hash)
+{
+    uint64_t key_hash = header_cache_hash(path, st, content_hash);
+    struct header_cache_shard *shard = &header_cache_shards[key_hash & (HEADER_CACHE_SHARDS - 1)];
+    pthread_mutex_lock(&shard->lock);
+    if ((shard->count + 1) * 2 > shard->capacity)
+    {
+        header_cache_grow(shard);
+    }
+
+    size_t mask = shard->capacity - 1;
+    size_t index = (key_hash >> 32) & mask;
+    while (shard->entries[index] && !header_cache_matches(shard->entries[index], key_hash, path, st, content_hash))
+    {
+        index = (index + 1) & mask;
+    }
+
+    struct header_cache_entry *entry = shard->entries[index];
+    if (!entry)
+    {
+        entry = calloc(1, sizeof(struct header_cache_entry));
+        if (path)
+        {
+            entry->path = strdup(path);
+            entry->mtime = st->st_mtim;
+            entry->size = st->st_size;
+        }
+        entry->content_hash = content_hash;
+        entry->key_hash = key_hash;
+        pthread_mutex_init(&entry->lock, NULL);
+        shard->entries[index] = entry;
+        shard->count++;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return entry;
+}
+
+// What load returned for the entry, loaded by the first thread that gets here
+static const void *header_cache_load(struct header_cache_entry *entry, const void *(*load)(void *data), void *data)
+{
+    if (!atomic_load_explicit(&entry->loaded, memory_order_acquire))
+    {
+        pthread_mutex_lock(&entry->lock);
+        if (!atomic_load_explicit(&entry->loaded, memory_order_relaxed))
+        {
+            entry->value = load(data);
+            atomic_store_explicit(&entry->loaded, true, memory_order_release);
+        }
+        pthread_mutex_unlock(&entry->lock);
+    }
+
+    return entry->value;
+}
+
+/**
+ * What load returned for the header at path, the first time the header was asked for
+ * with its current modification time and size. Only the path is looked at to tell, the
+ * header is read by load alone. Every thread of the process shares what it returned, so
+ * it must not be changed once it's returned. Only one thread ever calls load for a
+ * header, the others asking for it meanwhile wait for it to finish. NULL when load
+ * returned NULL or the header can't be looked at
+ */
+const void *header_cache_file(const char *path, const void *(*load)(void *data), void *data)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+    {
+        return NULL;
+    }
+
+    pthread_once(&header_cache_once, header_cache_init);
+    return header_cache_load(header_cache_entry(path, &st, 0), load, data);
+}
+
+/**
+ * What load returned for contents with content_hash, the first time they were asked for.
+ * Headers with the same contents share it, whatever their path. Shared and loaded once
+ * like with header_cache_file
+ */
+const void *header_cache_find(uint64_t content_hash, const void *(*load)(void *data), void *data)
+{
+    pthread_once(&header_cache_once, header_cache_init);
+    return header_cache_load(header_cache_entry(NULL, NULL, content_hash), load, data);
+}
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <dirent.h>
+#include <pthread.h>
+#include "compiler.h"
+#include "helpers/intern.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+
+#define HEADER_SEARCH_INITIAL_CAPACITY 64
+
+// A pair of strings interned in header_search_strings and what it maps to
+struct header_search_slot
+{
+    const char *first;
+    const char *second;
+    const char *value;
+    bool used;
+};
+
+// Open addressing over pairs of interned strings
+struct header_search_table
+{
+    struct header_search_slot *slots;
+    size_t capacity;
+    size_t count;
+};
+
+// Everything the search finds out is kept for the life of the process, so every compile
+// of a batch shares it and the filesystem is asked about anything only once
+static pthread_mutex_t header_search_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct intern_table *header_search_strings;
+// (including directory, name) -> canonical path of the header next to the directory, NULL
+// when there is none. Absolute names have no including directory
+static struct header_search_table header_search_results;
+// (search directories, name) -> canonical path of the header in the first of the
+// directories that has it, NULL when none does
+static struct header_search_table header_search_dir_results;
+// (directory, NULL) -> the directory once it has been listed, NULL when it can't be read
+static struct header_search_table header_search_directories;
+// (directory, name) of every entry of the directories listed
+static struct header_search_table header_search_entries;
+// (path, NULL) -> the path resolved to its canonical form
+static struct header_search_table header_search_canonical;
+
+static const char *header_search_intern(const char *str, size_t len)
+{
+    return intern(header_search_strings, str, len);
+}
+
+static size_t header_search_hash(const char *first, const char *second)
+{
+    uint64_t hash = ((uintptr_t)first ^ (uintptr_t)second * 31) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ hash >> 32;
+}
+
+static void header_search_grow(struct header_search_table *table)
+{
+    struct header_search_slot *old_slots = table->slots;
+    size_t old_capacity = table->capacity;
+    table->capacity = old_capacity ? old_capacity * 2 : HEADER_SEARCH_INITIAL_CAPACITY;
+    table->slots = calloc(table->capacity, sizeof(struct header_search_slot));
+
+    size_t mask = table->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_slots[i].used)
+        {
+            continue;
+        }
+
+        size_t index = header_search_hash(old_slots[i].first, old_slots[i].second) & mask;
+        while (table->slots[index].used)
+        {
+            index = (index + 1) & mask;
+        }
+        table->slots[index] = old_slots[i];
+    }
+    free(old_slots);
+}
+
+// The slot of a pair, an unused one to fill in when the pair isn't in the table. It stays
+// valid until the next lookup in the same table
+static struct header_search_slot *header_search_lookup(struct header_search_table *table, const char *first, const char *second)
+{
+    if ((table->count + 1) * 2 > table->capacity)
+    {
+        header_search_grow(table);
+    }
+
+    size_t mask = table->capacity - 1;
+    size_t index = header_search_hash(first, second) & mask;
+    while (table->slots[index].used && (table->slots[index].first != first || table->slots[index].second != second))
+    {
+        index = (index + 1) & mask;
+    }
+    return &table->slots[index];
+}
+
+static void header_search_fill(struct header_search_table *table, struct header_search_slot *slot, const char *first, const char *second, const char *value)
+{
+    *slot = (struct header_search_slot){.first = first, .second = second, .value = value, .used = true};
+    table->count++;
+}
+
+// Lists a directory the first time it is looked in. False when it can't be read
+static bool header_search_list(const char *dir)
+{
+    struct header_search_slot *slot = header_search_lookup(&header_search_directories, dir, NULL);
+    if (slot->used)
+    {
+        return slot->value != NULL;
+    }
+
+    DIR *stream = opendir(dir);
+    header_search_fill(&header_search_directories, slot, dir, NULL, stream ? dir : NULL);
+    if (!stream)
+    {
+        return false;
+    }
+
+    struct dirent *entry = NULL;
+    while ((entry = readdir(stream)))
+    {
+        const char *name = header_search_intern(entry->d_name, strlen(entry->d_name));
+        struct header_search_slot *entry_slot = header_search_lookup(&header_search_entries, dir, name);
+        if (!entry_slot->used)
+        {
+            header_search_fill(&header_search_entries, entry_slot, dir, name, name);
+        }
+    }
+    closedir(stream);
+    return true;
+}
+
+// The path of name inside dir when the listings say it is there, NULL otherwise. Every
+// directory on the way is listed rather than probed
+static const char *header_search_exists(const char *dir, const char *name)
+{
+    char path[PATH_MAX];
+    const char *current = dir;
+    const char *component = name;
+    while (true)
+    {
+        const char *slash = strchr(component, '/');
+        size_t length = slash ? (size_t)(slash - component) : strlen(component);
+        if (length)
+        {
+            const char *entry = header_search_intern(component, length);
+            if (!header_search_list(current) || !header_search_lookup(&header_search_entries, current, entry)->used)
+            {
+                return NULL;
+            }
+
+            int written = snprintf(path, sizeof(path), "%s/%s", S_EQ(current, "/") ? "" : current, entry);
+            if (written < 0 || written >= (int)sizeof(path))
+            {
+                return NULL;
+            }
+            current = header_search_intern(path, written);
+        }
+
+        if (!slash)
+        {
+            return current;
+        }
+        component = slash + 1;
+    }
+}
+
+// Resolves a path to its canonical form, so that every way of naming a header ends up
+// with the same path. NULL when there is no such file
+static const char *header_search_canonical_path(const char *path)
+{
+    struct header_search_slot *slot = header_search_lookup(&header_search_canonical, path, NULL);
+    if (!slot->used)
+    {
+        char resolved[PATH_MAX];
+        const char *canonical = realpath(path, resolved) ? header_search_intern(resolved, strlen(resolved)) : NULL;
+        header_search_fill(&header_search_canonical, slot, path, NULL, canonical);
+    }
+
+    return slot->value;
+}
+
+static const char *header_search_in(const char *dir, const char *name)
+{
+    const char *path = header_search_exists(dir, name);
+    return path ? header_search_canonical_path(path) : NULL;
+}
+
+// The search directories as one interned string, compiles searching the same
+// directories share their results
+static const char *header_search_dirs_key(struct vector *dirs)
+{
+    struct buffer *buffer = buffer_create();
+    for (int i = 0; i < vector_count(dirs); i++)
+    {
+        const char *dir = *(const char **)vector_at(dirs, i);
+        buffer_write_bytes(buffer, dir, strlen(dir) + 1);
+    }
+
+    const char *key = header_search_intern(buffer_ptr(buffer), buffer->len);
+    buffer_free(buffer);
+    return key;
+}
+
+static const char *header_search_in_dirs(struct vector *dirs, const char *name)
+{
+    const char *path = NULL;
+    for (int i = 0; !path && i < vector_count(dirs); i++)
+    {
+        const char *dir = *(const char **)vector_at(dirs, i);
+        path = header_search_in(header_search_intern(dir, strlen(dir)), name);
+    }
+
+    return path;
+}
+
+// Looks up name like the given includer would, next to the including file first and
+// then in the search directories dirs, a vector of const char *. Absolute names are
+// taken as they are
+const char *header_search_find(const char *name, const char *including_file, struct vector *dirs)
+{
+    pthread_mutex_lock(&header_search_lock);
+    if (!header_search_strings)
+    {
+        header_search_strings = intern_table_create();
+    }
+
+    // "" names are looked for next to the including file, <> ones are not
+    const char *dir = NULL;
+    if (including_file && name[0] != '/')
+    {
+        const char *slash = strrchr(including_file, '/');
+        if (!slash)
+        {
+            dir = header_search_intern(".", 1);
+        }
+        else
+        {
+            dir = header_search_intern(including_file, slash == including_file ? 1 : slash - including_file);
+        }
+    }
+
+    const char *key = header_search_intern(name, strlen(name));
+    const char *path = NULL;
+    if (dir || name[0] == '/')
+    {
+        struct header_search_slot *slot = header_search_lookup(&header_search_results, dir, key);
+        if (!slot->used)
+        {
+            header_search_fill(&header_search_results, slot, dir, key, dir ? header_search_in(dir, name) : header_search_in("/", name + 1));
+        }
+        path = slot->value;
+    }
+
+    if (!path && name[0] != '/')
+    {
+        const char *dirs_key = header_search_dirs_key(dirs);
+        struct header_search_slot *slot = header_search_lookup(&header_search_dir_results, dirs_key, key);
+        if (!slot->used)
+        {
+            header_search_fill(&header_search_dir_results, slot, dirs_key, key, header_search_in_dirs(dirs, name));
+        }
+        path = slot->value;
+    }
+    pthread_mutex_unlock(&header_search_lock);
+    return path;
+}
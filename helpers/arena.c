@@ -0,0 +1,77 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct arena *arena_create()
+{
+    return calloc(1, sizeof(struct arena));
+}
+
+static void *arena_alloc_aligned(struct arena *arena, size_t size, size_t alignment)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    size_t offset = chunk ? (chunk->used + alignment - 1) & ~(alignment - 1) : 0;
+    if (!chunk || offset + size > chunk->size)
+    {
+        size_t chunk_size = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+        chunk->prev = arena->chunk;
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        arena->chunk = chunk;
+        offset = 0;
+    }
+
+    chunk->used = offset + size;
+    return chunk->data + offset;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_ALIGNMENT);
+}
+
+char *arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+    char *copy = arena_alloc_aligned(arena, len + 1, 1);
+    memcpy(copy, str, len);
+    copy[len] = 0x00;
+    return copy;
+}
+
+void arena_adopt(struct arena *arena, struct arena *other)
+{
+    struct arena_chunk *chunk = other->chunk;
+    if (chunk)
+    {
+        // Keep allocating from the arena's own chunk, the adopted ones go beneath it
+        struct arena_chunk *oldest = chunk;
+        while (oldest->prev)
+        {
+            oldest = oldest->prev;
+        }
+
+        if (arena->chunk)
+        {
+            oldest->prev = arena->chunk->prev;
+            arena->chunk->prev = chunk;
+        }
+        else
+        {
+            arena->chunk = chunk;
+        }
+    }
+    free(other);
+}
+
+void arena_free(struct arena *arena)
+{
+    struct arena_chunk *chunk = arena->chunk;
+    while (chunk)
+    {
+        struct arena_chunk *prev = chunk->prev;
+        free(chunk);
+        chunk = prev;
+    }
+    free(arena);
+}
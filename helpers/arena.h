@@ -0,0 +1,43 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Allocations are carved out of chunks of this size, larger ones get a chunk of their own
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT 8
+
+struct arena_chunk
+{
+    struct arena_chunk *prev;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+struct arena
+{
+    struct arena_chunk *chunk;
+};
+
+struct arena *arena_create();
+
+/**
+ * Returns size bytes that live until the arena is freed, nothing is freed on its own
+ */
+void *arena_alloc(struct arena *arena, size_t size);
+
+/**
+ * Copies len bytes of the given string into the arena and null terminates the copy
+ */
+char *arena_strndup(struct arena *arena, const char *str, size_t len);
+
+/**
+ * Moves every allocation of other into arena, they then live until arena is freed.
+ * other is freed
+ */
+void arena_adopt(struct arena *arena, struct arena *other);
+
+void arena_free(struct arena *arena);
+
+#endif
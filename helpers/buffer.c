@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
 struct buffer *buffer_create()
 {
@@ -61,6 +62,14 @@ void buffer_write(struct buffer *buffer, char c)
     buffer->len++;
 }
 
+void buffer_write_bytes(struct buffer *buffer, const void *data, size_t len)
+{
+    buffer_need(buffer, len);
+
+    memcpy(&buffer->data[buffer->len], data, len);
+    buffer->len += len;
+}
+
 void *buffer_ptr(struct buffer *buffer)
 {
     return buffer->data;
@@ -87,6 +96,12 @@ char buffer_peek(struct buffer *buffer)
     return c;
 }
 
+void buffer_clear(struct buffer *buffer)
+{
+    buffer->len = 0;
+    buffer->rindex = 0;
+}
+
 void buffer_free(struct buffer *buffer)
 {
     free(buffer->data);
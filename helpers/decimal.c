@@ -0,0 +1,98 @@
+#include "decimal.h"
+#include <string.h>
+
+// Generated by tools/pow5gen.c, 5^q is at q - DECIMAL_SMALLEST_POWER
+extern const uint64_t decimal_pow5_128[][2];
+
+#define DECIMAL_MANTISSA_BITS 52
+#define DECIMAL_EXPONENT_BIAS 1023
+#define DECIMAL_INFINITE_POWER 0x7FF
+
+static const double decimal_exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+static double decimal_from_bits(uint64_t mantissa, int power2)
+{
+    uint64_t bits = mantissa | (uint64_t)power2 << DECIMAL_MANTISSA_BITS;
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+double decimal_to_double(uint64_t mantissa, int exponent)
+{
+    // Both the mantissa and the power of ten are exact doubles, so one rounding is all
+    if (mantissa <= 1ULL << 53 && exponent >= -22 && exponent <= 22)
+    {
+        double value = mantissa;
+        return exponent < 0 ? value / decimal_exact_powers[-exponent] : value * decimal_exact_powers[exponent];
+    }
+
+    if (mantissa == 0 || exponent < DECIMAL_SMALLEST_POWER)
+    {
+        return 0;
+    }
+
+    if (exponent > DECIMAL_LARGEST_POWER)
+    {
+        return decimal_from_bits(0, DECIMAL_INFINITE_POWER);
+    }
+
+    int leading_zeros = __builtin_clzll(mantissa);
+    mantissa <<= leading_zeros;
+
+    // The top 64 bits of mantissa * 5^exponent. The low bits of the first product are only
+    // unsure when they're all ones, the second product settles them
+    const uint64_t *power = decimal_pow5_128[exponent - DECIMAL_SMALLEST_POWER];
+    unsigned __int128 product = (unsigned __int128)mantissa * power[0];
+    uint64_t high = product >> 64;
+    uint64_t low = product;
+    if ((high & 0x1FF) == 0x1FF)
+    {
+        uint64_t second = ((unsigned __int128)mantissa * power[1]) >> 64;
+        low += second;
+        high += second > low;
+    }
+
+    int upper_bit = high >> 63;
+    int shift = upper_bit + 64 - DECIMAL_MANTISSA_BITS - 3;
+    uint64_t bits = high >> shift;
+    // floor(log2(10^exponent)) + 63, exponent * log2(10) in 16.16 fixed point
+    int power2 = (((152170 + 65536) * exponent) >> 16) + 63 + upper_bit - leading_zeros + DECIMAL_EXPONENT_BIAS;
+
+    if (power2 <= 0)
+    {
+        // Subnormal, the mantissa is shifted to where the smallest exponent needs it
+        if (-power2 + 1 >= 64)
+        {
+            return 0;
+        }
+
+        bits >>= -power2 + 1;
+        bits += bits & 1;
+        bits >>= 1;
+        return decimal_from_bits(bits, bits < 1ULL << DECIMAL_MANTISSA_BITS ? 0 : 1);
+    }
+
+    // A product with nothing below the kept bits may be exactly halfway, which rounds to
+    // even rather than up. Only these exponents can be exact
+    if (low <= 1 && exponent >= -4 && exponent <= 23 && (bits & 3) == 1 && bits << shift == high)
+    {
+        bits &= ~1ULL;
+    }
+
+    bits += bits & 1;
+    bits >>= 1;
+    if (bits >= 2ULL << DECIMAL_MANTISSA_BITS)
+    {
+        bits = 1ULL << DECIMAL_MANTISSA_BITS;
+        power2++;
+    }
+
+    if (power2 >= DECIMAL_INFINITE_POWER)
+    {
+        return decimal_from_bits(0, DECIMAL_INFINITE_POWER);
+    }
+    return decimal_from_bits(bits & ~(1ULL << DECIMAL_MANTISSA_BITS), power2);
+}
@@ -0,0 +1,18 @@
+#ifndef DECIMAL_H
+#define DECIMAL_H
+
+#include <stdint.h>
+
+// Powers of ten decimal_to_double has exact tables for, anything smaller is zero and
+// anything larger is infinity
+#define DECIMAL_SMALLEST_POWER -342
+#define DECIMAL_LARGEST_POWER 308
+
+/**
+ * Converts mantissa * 10^exponent to the nearest double, ties to even. Small values are
+ * multiplied out exactly, the rest go through the Eisel-Lemire algorithm over a table of
+ * 128 bit powers of five, which is exact for every 64 bit mantissa
+ */
+double decimal_to_double(uint64_t mantissa, int exponent);
+
+#endif
@@ -0,0 +1,112 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t intern_hash(const char *str, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+struct intern_table *intern_table_create()
+{
+    struct intern_table *table = calloc(1, sizeof(struct intern_table));
+    for (int i = 0; i < INTERN_TOTAL_SHARDS; i++)
+    {
+        struct intern_shard *shard = &table->shards[i];
+        shard->total_slots = INTERN_INITIAL_SLOTS;
+        shard->slots = calloc(shard->total_slots, sizeof(struct intern_entry));
+        shard->strings = arena_create();
+        pthread_mutex_init(&shard->lock, NULL);
+    }
+    return table;
+}
+
+void intern_table_free(struct intern_table *table)
+{
+    for (int i = 0; i < INTERN_TOTAL_SHARDS; i++)
+    {
+        struct intern_shard *shard = &table->shards[i];
+        arena_free(shard->strings);
+        free(shard->slots);
+        pthread_mutex_destroy(&shard->lock);
+    }
+    free(table);
+}
+
+void intern_table_set_concurrent(struct intern_table *table, bool concurrent)
+{
+    table->concurrent = concurrent;
+}
+
+static void intern_grow(struct intern_shard *shard)
+{
+    size_t total_slots = shard->total_slots * 2;
+    struct intern_entry *slots = calloc(total_slots, sizeof(struct intern_entry));
+    for (size_t i = 0; i < shard->total_slots; i++)
+    {
+        struct intern_entry *entry = &shard->slots[i];
+        if (!entry->str)
+        {
+            continue;
+        }
+
+        size_t index = entry->hash & (total_slots - 1);
+        while (slots[index].str)
+        {
+            index = (index + 1) & (total_slots - 1);
+        }
+        slots[index] = *entry;
+    }
+
+    free(shard->slots);
+    shard->slots = slots;
+    shard->total_slots = total_slots;
+}
+
+static const char *intern_in_shard(struct intern_shard *shard, uint32_t hash, const char *str, size_t len)
+{
+    size_t index = hash & (shard->total_slots - 1);
+    while (shard->slots[index].str)
+    {
+        struct intern_entry *entry = &shard->slots[index];
+        if (entry->hash == hash && entry->len == len && memcmp(entry->str, str, len) == 0)
+        {
+            return entry->str;
+        }
+        index = (index + 1) & (shard->total_slots - 1);
+    }
+
+    const char *copy = arena_strndup(shard->strings, str, len);
+    shard->slots[index] = (struct intern_entry){.str = copy, .len = len, .hash = hash};
+    shard->count++;
+
+    // Keep the shard at most half full so probe sequences stay short
+    if (shard->count * 2 > shard->total_slots)
+    {
+        intern_grow(shard);
+    }
+    return copy;
+}
+
+const char *intern(struct intern_table *table, const char *str, size_t len)
+{
+    uint32_t hash = intern_hash(str, len);
+    // The low bits pick the slot, the top bits pick the shard
+    struct intern_shard *shard = &table->shards[hash >> 28];
+    if (!table->concurrent)
+    {
+        return intern_in_shard(shard, hash, str, len);
+    }
+
+    pthread_mutex_lock(&shard->lock);
+    const char *interned = intern_in_shard(shard, hash, str, len);
+    pthread_mutex_unlock(&shard->lock);
+    return interned;
+}
@@ -0,0 +1,57 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "arena.h"
+
+#define INTERN_INITIAL_SLOTS 256
+// The table is split into independent shards by hash so concurrent users rarely meet
+#define INTERN_TOTAL_SHARDS 16
+
+struct intern_entry
+{
+    const char *str;
+    uint32_t len;
+    uint32_t hash;
+};
+
+struct intern_shard
+{
+    // Open addressed, the amount of slots is always a power of two
+    struct intern_entry *slots;
+    size_t total_slots;
+    size_t count;
+
+    // The interned strings are copied in here
+    struct arena *strings;
+    pthread_mutex_t lock;
+};
+
+struct intern_table
+{
+    struct intern_shard shards[INTERN_TOTAL_SHARDS];
+    // Shards are only locked while the table is shared between threads
+    bool concurrent;
+};
+
+struct intern_table *intern_table_create();
+void intern_table_free(struct intern_table *table);
+
+/**
+ * Makes intern safe to call from several threads at once, or stops locking again once
+ * the table is only used by one thread
+ */
+void intern_table_set_concurrent(struct intern_table *table, bool concurrent);
+
+/**
+ * Returns the one copy of the given string held by the table, adding it when it isn't
+ * there yet. Two interned strings are equal only if they are the same pointer.
+ *
+ * The returned string is null terminated and lives as long as the table
+ */
+const char *intern(struct intern_table *table, const char *str, size_t len);
+
+#endif
@@ -0,0 +1,266 @@
+#include "scan.h"
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static size_t scan_find_either_scalar(const char *ptr, size_t len, char a, char b)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ptr[i] == a || ptr[i] == b)
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t scan_skip_blanks_scalar(const char *ptr, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ptr[i] != ' ' && ptr[i] != '\t')
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+static size_t scan_count_newlines_scalar(const char *ptr, size_t len, size_t *last)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ptr[i] == '\n')
+        {
+            count++;
+            if (last)
+            {
+                *last = i;
+            }
+        }
+    }
+    return count;
+}
+
+static size_t scan_find_line_starts_scalar(const char *ptr, size_t len, uint32_t *out)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ptr[i] == '\n')
+        {
+            out[count++] = i + 1;
+        }
+    }
+    return count;
+}
+
+#ifdef SCAN_X86
+// The wide kernels finish with the scalar loops rather than calling each other, mixing
+// legacy SSE and AVX encodings stalls on a lot of CPUs
+__attribute__((target("sse2"))) static size_t scan_find_either_sse2(const char *ptr, size_t len, char a, char b)
+{
+    __m128i va = _mm_set1_epi8(a);
+    __m128i vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_find_either_scalar(ptr + i, len - i, a, b);
+}
+
+__attribute__((target("sse2"))) static size_t scan_skip_blanks_sse2(const char *ptr, size_t len)
+{
+    __m128i space = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+        int mask = ~_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab))) & 0xffff;
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_skip_blanks_scalar(ptr + i, len - i);
+}
+
+__attribute__((target("sse2"))) static size_t scan_count_newlines_sse2(const char *ptr, size_t len, size_t *last)
+{
+    __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        if (mask)
+        {
+            count += __builtin_popcount(mask);
+            if (last)
+            {
+                *last = i + 31 - __builtin_clz(mask);
+            }
+        }
+    }
+
+    size_t tail_last = 0;
+    size_t tail_count = scan_count_newlines_scalar(ptr + i, len - i, &tail_last);
+    if (tail_count && last)
+    {
+        *last = i + tail_last;
+    }
+    return count + tail_count;
+}
+
+__attribute__((target("sse2"))) static size_t scan_find_line_starts_sse2(const char *ptr, size_t len, uint32_t *out)
+{
+    __m128i newline = _mm_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(ptr + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, newline));
+        while (mask)
+        {
+            out[count++] = i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+
+    size_t tail_count = scan_find_line_starts_scalar(ptr + i, len - i, out + count);
+    for (size_t j = count; j < count + tail_count; j++)
+    {
+        out[j] += i;
+    }
+    return count + tail_count;
+}
+
+__attribute__((target("avx2"))) static size_t scan_find_either_avx2(const char *ptr, size_t len, char a, char b)
+{
+    __m256i va = _mm256_set1_epi8(a);
+    __m256i vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va), _mm256_cmpeq_epi8(v, vb)));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_find_either_scalar(ptr + i, len - i, a, b);
+}
+
+__attribute__((target("avx2"))) static size_t scan_skip_blanks_avx2(const char *ptr, size_t len)
+{
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        unsigned int mask = ~(unsigned int)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)));
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + scan_skip_blanks_scalar(ptr + i, len - i);
+}
+
+__attribute__((target("avx2"))) static size_t scan_count_newlines_avx2(const char *ptr, size_t len, size_t *last)
+{
+    __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        if (mask)
+        {
+            count += __builtin_popcount(mask);
+            if (last)
+            {
+                *last = i + 31 - __builtin_clz(mask);
+            }
+        }
+    }
+
+    size_t tail_last = 0;
+    size_t tail_count = scan_count_newlines_scalar(ptr + i, len - i, &tail_last);
+    if (tail_count && last)
+    {
+        *last = i + tail_last;
+    }
+    return count + tail_count;
+}
+
+__attribute__((target("avx2"))) static size_t scan_find_line_starts_avx2(const char *ptr, size_t len, uint32_t *out)
+{
+    __m256i newline = _mm256_set1_epi8('\n');
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(ptr + i));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, newline));
+        while (mask)
+        {
+            out[count++] = i + __builtin_ctz(mask) + 1;
+            mask &= mask - 1;
+        }
+    }
+
+    size_t tail_count = scan_find_line_starts_scalar(ptr + i, len - i, out + count);
+    for (size_t j = count; j < count + tail_count; j++)
+    {
+        out[j] += i;
+    }
+    return count + tail_count;
+}
+#endif
+
+struct scan_functions scan = {
+    .find_either = scan_find_either_scalar,
+    .skip_blanks = scan_skip_blanks_scalar,
+    .count_newlines = scan_count_newlines_scalar,
+    .find_line_starts = scan_find_line_starts_scalar};
+
+void scan_select()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        scan = (struct scan_functions){
+            .find_either = scan_find_either_avx2,
+            .skip_blanks = scan_skip_blanks_avx2,
+            .count_newlines = scan_count_newlines_avx2,
+            .find_line_starts = scan_find_line_starts_avx2};
+    }
+    else if (__builtin_cpu_supports("sse2"))
+    {
+        scan = (struct scan_functions){
+            .find_either = scan_find_either_sse2,
+            .skip_blanks = scan_skip_blanks_sse2,
+            .count_newlines = scan_count_newlines_sse2,
+            .find_line_starts = scan_find_line_starts_sse2};
+    }
+#endif
+}
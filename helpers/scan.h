@@ -0,0 +1,59 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Byte scanning kernels. The widest implementation the CPU supports is picked by
+// scan_select, AVX2 and SSE2 on x86 with a scalar fallback everywhere else
+struct scan_functions
+{
+    // Index of the first byte equal to a or b, len when there is none
+    size_t (*find_either)(const char *ptr, size_t len, char a, char b);
+    // Index of the first byte that is neither a space nor a tab, len when there is none
+    size_t (*skip_blanks)(const char *ptr, size_t len);
+    // Amount of newlines, *last is set to the index of the last one when there are any and
+    // last isn't NULL
+    size_t (*count_newlines)(const char *ptr, size_t len, size_t *last);
+    // Writes the index after every newline to out, which must have room for all of them,
+    // and returns the amount
+    size_t (*find_line_starts)(const char *ptr, size_t len, uint32_t *out);
+};
+
+// Runs shorter than this aren't worth a call into the kernels
+#define SCAN_MIN_LENGTH 16
+
+extern struct scan_functions scan;
+
+/**
+ * Counts newlines like scan.count_newlines, single characters and other short runs are
+ * counted inline
+ */
+static inline size_t scan_count_newlines(const char *ptr, size_t len, size_t *last)
+{
+    if (len >= SCAN_MIN_LENGTH)
+    {
+        return scan.count_newlines(ptr, len, last);
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (ptr[i] == '\n')
+        {
+            count++;
+            if (last)
+            {
+                *last = i;
+            }
+        }
+    }
+    return count;
+}
+
+/**
+ * Picks the kernels for the running CPU. Safe to call more than once
+ */
+void scan_select();
+
+#endif
@@ -0,0 +1,181 @@
+#include "compiler.h"
+
+// Tokens of the previous input are reused between edits, in the store they're already in.
+// Lexing restarts at the last newline outside of any bracket before an edit, where the
+// lexer's state is known, and stops at the first such newline after it that the previous
+// tokens also have. Only the tokens in between are replaced, the previous tokens after
+// them are the same and are only moved along
+struct lex_incremental
+{
+    struct lex_process *process;
+    // The previous tokens, the ones before index are already those of the new input
+    struct token_store *tokens;
+    int index;
+    // Tokens lexed again, after the sync token lexing restarted from
+    struct token_store *lexed;
+
+    // Characters the edits lexed through so far added, the previous tokens from index on
+    // have been moved along by it
+    size_t offset_delta;
+};
+
+static bool lex_incremental_is_sync_token(struct token_store *tokens, int index)
+{
+    return (tokens->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_NEWLINE && !tokens->brackets[index];
+}
+
+// Index of the first previous token from low on starting at or after offset
+static int lex_incremental_find(struct lex_incremental *incremental, int low, size_t offset)
+{
+    int high = incremental->tokens->count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (incremental->tokens->offsets[middle] < offset)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Index of the token after the last sync token before offset, where lexing restarts
+static int lex_incremental_restart_index(struct lex_incremental *incremental, size_t offset)
+{
+    int start = lex_incremental_find(incremental, incremental->index, offset);
+    struct token_store *tokens = incremental->tokens;
+    while (start > incremental->index)
+    {
+        if (lex_incremental_is_sync_token(tokens, start - 1) && tokens->offsets[start - 1] + 1 <= offset)
+        {
+            break;
+        }
+        start--;
+    }
+    return start;
+}
+
+// Lexes again from the token at start into lexed, after the sync token before it. The
+// lexer marks a token once it reaches the blanks after it, which it won't do for that one
+static void lex_incremental_restart(struct lex_incremental *incremental, int start)
+{
+    struct lex_process *process = incremental->process;
+    struct token_store *lexed = incremental->lexed;
+    token_store_clear(lexed);
+    process->tokens = lexed;
+    process->offset = 0;
+    process->current_expression_count = 0;
+    process->leading_whitespace = false;
+    if (start > 0)
+    {
+        token_store_append(lexed, incremental->tokens, start - 1, start, 0);
+        process->offset = lexed->offsets[0] + 1;
+    }
+
+    struct compile_process *compiler = process->compiler;
+    compiler->cfile.index = process->offset;
+    if (start > 0)
+    {
+        struct lex_process_span span = lex_process_peek_span(process, 1);
+        token_store_set_whitespace(lexed, 0, span.len && (span.ptr[0] == ' ' || span.ptr[0] == '\t'));
+    }
+}
+
+// Replaces the previous tokens from start to end with the ones lexed up to lexed_end, the
+// previous tokens after them move along by offset_delta
+static void lex_incremental_replace(struct lex_incremental *incremental, int start, int end, int lexed_end, size_t offset_delta)
+{
+    struct token_store *tokens = incremental->tokens;
+    struct token_store *lexed = incremental->lexed;
+    int first = 0;
+    if (start > 0)
+    {
+        token_store_set_whitespace(tokens, start - 1, lexed->kinds[0] & TOKEN_STORE_WHITESPACE);
+        first = 1;
+    }
+
+    token_store_splice(tokens, start, end, lexed, first, lexed_end, offset_delta);
+    incremental->process->tokens = tokens;
+    // Past the sync token the previous tokens lined up again at
+    incremental->index = start + lexed_end - first + 1;
+}
+
+/**
+ * Lexes the input again after edits to the previous input, whose tokens are old_tokens.
+ * old_tokens is updated in place and becomes the process's store, the store the process
+ * had is freed. Edits are in the order of their offsets and don't overlap. Inputs that
+ * aren't read through compile_process_peek_span are lexed again whole
+ */
+int lex_incremental(struct lex_process *process, struct token_store *old_tokens, struct lex_edit *edits, int total_edits)
+{
+    token_store_free(process->tokens);
+    process->tokens = old_tokens;
+    old_tokens->compiler = process->compiler;
+    if (process->function->peek_span != compile_process_peek_span)
+    {
+        token_store_clear(old_tokens);
+        return lex(process);
+    }
+
+    lex_begin(process);
+    struct lex_incremental incremental = {.process = process, .tokens = old_tokens, .lexed = token_store_create(process->compiler)};
+    int edit = 0;
+    while (edit < total_edits)
+    {
+        int start = lex_incremental_restart_index(&incremental, edits[edit].offset + incremental.offset_delta);
+        lex_incremental_restart(&incremental, start);
+
+        // Lex through the edit and any others reached on the way, until the previous
+        // tokens line up again
+        int first_edit = edit;
+        size_t offset_delta = incremental.offset_delta;
+        while (true)
+        {
+            struct token *token = lex_next_token(process);
+            if (!token)
+            {
+                lex_end(process);
+                lex_incremental_replace(&incremental, start, old_tokens->count, incremental.lexed->count, 0);
+                edit = total_edits;
+                break;
+            }
+
+            int index = token_store_push(incremental.lexed, token);
+            if (!lex_incremental_is_sync_token(incremental.lexed, index) || process->current_expression_count != 0)
+            {
+                continue;
+            }
+
+            while (edit < total_edits && edits[edit].offset + offset_delta + edits[edit].new_length <= token->offset)
+            {
+                offset_delta += edits[edit].new_length - edits[edit].old_length;
+                edit++;
+            }
+
+            bool inside_edit = edit < total_edits && edits[edit].offset + offset_delta <= token->offset;
+            if (edit == first_edit || inside_edit)
+            {
+                continue;
+            }
+
+            // The previous tokens from start on have only been moved along by the edits
+            // before this one
+            size_t previous_offset = token->offset - offset_delta + incremental.offset_delta;
+            int previous = lex_incremental_find(&incremental, start, previous_offset);
+            if (previous < old_tokens->count && old_tokens->offsets[previous] == previous_offset && lex_incremental_is_sync_token(old_tokens, previous))
+            {
+                // The previous sync token stays, it already knows whether blanks follow it
+                lex_incremental_replace(&incremental, start, previous, index, offset_delta - incremental.offset_delta);
+                incremental.offset_delta = offset_delta;
+                break;
+            }
+        }
+    }
+
+    token_store_free(incremental.lexed);
+    return LEXICAL_ANALYSIS_ALL_OK;
+}
@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/intern.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
+
+// Inputs are split into chunks of at least this size, smaller inputs are lexed serially
+#define LEX_PARALLEL_MIN_CHUNK_SIZE (256 * 1024)
+
+// A point in a chunk right after a newline token with no bracket open. Lexing from here
+// gives the same tokens whatever came before, so this is where the real lexer can pick
+// up the speculative tokens
+struct lex_parallel_sync_point
+{
+    size_t offset;
+    // Index of the first token after the point
+    int index;
+};
+
+struct lex_parallel_chunk
+{
+    struct compile_process *compiler;
+    // The chunk is responsible for the tokens starting in [start, end), the last one may
+    // run past end
+    size_t start;
+    size_t end;
+    // Read position in the compile process's input
+    size_t index;
+
+    struct lex_process *process;
+    struct vector *sync_points;
+    // A closing bracket was let through, so the chunk can't be taken from its start
+    bool unmatched_close;
+    pthread_t thread;
+};
+
+static struct lex_process_span lex_parallel_peek_span(struct lex_process *process, size_t min)
+{
+    struct lex_parallel_chunk *chunk = lex_process_private(process);
+    struct compile_process *compiler = chunk->compiler;
+    return (struct lex_process_span){.ptr = compiler->cfile.data + chunk->index, .len = compiler->cfile.size - chunk->index};
+}
+
+static void lex_parallel_skip_span(struct lex_process *process, size_t amount)
+{
+    struct lex_parallel_chunk *chunk = lex_process_private(process);
+    chunk->index += amount;
+}
+
+static struct lex_process_functions lex_parallel_functions = {
+    .peek_span = lex_parallel_peek_span,
+    .skip_span = lex_parallel_skip_span};
+
+// Drops the tokens after the last sync point, a chunk that failed ends there
+static void lex_parallel_truncate(struct lex_parallel_chunk *chunk)
+{
+    struct lex_process *process = chunk->process;
+    struct lex_parallel_sync_point *point = vector_back_or_null(chunk->sync_points);
+    int count = point ? point->index : 0;
+    while (process->tokens->count > count)
+    {
+        token_store_pop(process->tokens);
+    }
+
+    process->current_expression_count = 0;
+    process->offset = point ? point->offset : chunk->start;
+}
+
+static void *lex_parallel_chunk_run(void *arg)
+{
+    struct lex_parallel_chunk *chunk = arg;
+    struct lex_process *process = chunk->process;
+
+    jmp_buf speculation_failed;
+    process->speculation_failed = &speculation_failed;
+    if (setjmp(speculation_failed))
+    {
+        lex_parallel_truncate(chunk);
+        return NULL;
+    }
+
+    lex_begin(process);
+    while (process->offset < chunk->end)
+    {
+        struct token *token = lex_next_token(process);
+        if (!token)
+        {
+            break;
+        }
+
+        token_store_push(process->tokens, token);
+        if (process->unmatched_close)
+        {
+            // If the bracket really was opened before the chunk the real lexer closes it
+            // before any later sync point. If it wasn't, it is an error the real lexer
+            // has to reach, either way no earlier point can be used
+            vector_clear(chunk->sync_points);
+            chunk->unmatched_close = true;
+            process->unmatched_close = false;
+        }
+
+        if (token->type == TOKEN_TYPE_NEWLINE && process->current_expression_count == 0)
+        {
+            struct lex_parallel_sync_point point = {.offset = process->offset, .index = process->tokens->count};
+            vector_push(chunk->sync_points, &point);
+        }
+    }
+
+    return NULL;
+}
+
+// Appends the chunk's tokens from index on and continues from where the chunk stopped.
+// whitespace tells if blanks followed the token before index
+static void lex_parallel_splice(struct lex_process *process, struct lex_parallel_chunk *chunk, int index, bool whitespace)
+{
+    struct token_store *tokens = process->tokens;
+    if (tokens->count && whitespace)
+    {
+        token_store_set_whitespace(tokens, tokens->count - 1, true);
+    }
+
+    struct token_store *chunk_tokens = chunk->process->tokens;
+    token_store_append(tokens, chunk_tokens, index, chunk_tokens->count, 0);
+
+    struct lex_process *chunk_process = chunk->process;
+    process->offset = chunk_process->offset;
+    process->current_expression_count = chunk_process->current_expression_count;
+    process->expression_offset = chunk_process->expression_offset;
+
+    struct compile_process *compiler = process->compiler;
+    compiler->cfile.index = process->offset;
+}
+
+// Lexes serially from wherever the real lexer is until it reaches a sync point of the
+// chunk, or the end of the chunk
+static void lex_parallel_merge(struct lex_process *process, struct lex_parallel_chunk *chunk)
+{
+    if (process->offset == chunk->start && process->current_expression_count == 0 && !chunk->unmatched_close)
+    {
+        // The previous chunk ended exactly where this one started, so this one was lexed
+        // from the real state
+        lex_parallel_splice(process, chunk, 0, chunk->process->leading_whitespace);
+        return;
+    }
+
+    int next = 0;
+    while (process->offset < chunk->end)
+    {
+        struct token *token = lex_next_token(process);
+        if (!token)
+        {
+            return;
+        }
+
+        token_store_push(process->tokens, token);
+        if (token->type != TOKEN_TYPE_NEWLINE || process->current_expression_count != 0)
+        {
+            continue;
+        }
+
+        while (next < vector_count(chunk->sync_points) &&
+               ((struct lex_parallel_sync_point *)vector_at(chunk->sync_points, next))->offset < process->offset)
+        {
+            next++;
+        }
+
+        struct lex_parallel_sync_point *point = next < vector_count(chunk->sync_points) ? vector_at(chunk->sync_points, next) : NULL;
+        if (point && point->offset == process->offset)
+        {
+            struct token_store *chunk_tokens = chunk->process->tokens;
+            bool whitespace = chunk_tokens->kinds[point->index - 1] & TOKEN_STORE_WHITESPACE;
+            lex_parallel_splice(process, chunk, point->index, whitespace);
+            return;
+        }
+    }
+}
+
+// Joins the chunks from joined on, the ones before it are joined already, and frees them all
+static void lex_parallel_free_chunks(struct compile_process *compiler, struct lex_parallel_chunk *chunks, int joined, int total_chunks)
+{
+    for (int i = joined; i < total_chunks; i++)
+    {
+        pthread_join(chunks[i].thread, NULL);
+    }
+
+    for (int i = 0; i < total_chunks; i++)
+    {
+        struct lex_parallel_chunk *chunk = &chunks[i];
+        arena_adopt(compiler->lexemes, chunk->process->lexemes);
+        vector_free(chunk->sync_points);
+        lex_process_free(chunk->process);
+    }
+    free(chunks);
+}
+
+static int lex_parallel_total_threads(int threads, size_t size)
+{
+    if (threads <= 0)
+    {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+
+    size_t most = size / LEX_PARALLEL_MIN_CHUNK_SIZE;
+    return most < threads ? most : threads;
+}
+
+int lex_parallel(struct lex_process *process, int threads)
+{
+    struct compile_process *compiler = process->compiler;
+    const char *data = compiler->cfile.data;
+    size_t size = compiler->cfile.size;
+    threads = lex_parallel_total_threads(threads, size);
+    if (threads < 2 || process->function->peek_span != compile_process_peek_span)
+    {
+        return lex(process);
+    }
+
+    process->current_expression_count = 0;
+    process->offset = 0;
+    lex_begin(process);
+
+    // Chunks start right after a newline, each one is lexed as if it was the whole input
+    struct lex_parallel_chunk *chunks = calloc(threads, sizeof(struct lex_parallel_chunk));
+    int total_chunks = 0;
+    size_t start = 0;
+    intern_table_set_concurrent(compiler->interned, true);
+    while (start < size && total_chunks < threads)
+    {
+        size_t end = size;
+        size_t target = size / threads * (total_chunks + 1);
+        if (total_chunks < threads - 1 && target >= start)
+        {
+            const char *newline = memchr(data + target, '\n', size - target);
+            end = newline ? newline - data + 1 : size;
+        }
+
+        struct lex_parallel_chunk *chunk = &chunks[total_chunks++];
+        chunk->compiler = compiler;
+        chunk->start = start;
+        chunk->end = end;
+        chunk->index = start;
+        chunk->sync_points = vector_create(sizeof(struct lex_parallel_sync_point));
+        chunk->process = lex_process_create(compiler, &lex_parallel_functions, chunk);
+        chunk->process->lexemes = arena_create();
+        chunk->process->offset = start;
+        pthread_create(&chunk->thread, NULL, lex_parallel_chunk_run, chunk);
+        start = end;
+    }
+
+    // A speculative caller gives up on an error met while merging, the chunks still
+    // lexing are joined before it is jumped back to
+    jmp_buf *speculation_failed = process->speculation_failed;
+    jmp_buf merge_failed;
+    volatile int joined = 0;
+    if (speculation_failed)
+    {
+        process->speculation_failed = &merge_failed;
+        if (setjmp(merge_failed))
+        {
+            lex_parallel_free_chunks(compiler, chunks, joined, total_chunks);
+            intern_table_set_concurrent(compiler->interned, false);
+            process->speculation_failed = speculation_failed;
+            longjmp(*speculation_failed, 1);
+        }
+    }
+
+    // Chunks are merged in order as they finish
+    for (int i = 0; i < total_chunks; i++)
+    {
+        struct lex_parallel_chunk *chunk = &chunks[i];
+        pthread_join(chunk->thread, NULL);
+        joined = i + 1;
+        lex_parallel_merge(process, chunk);
+    }
+    intern_table_set_concurrent(compiler->interned, false);
+
+    // A failed last chunk stops short of the end of the input
+    struct token *token = process->offset < size ? lex_next_token(process) : NULL;
+    while (token)
+    {
+        token_store_push(process->tokens, token);
+        token = lex_next_token(process);
+    }
+    lex_end(process);
+
+    process->speculation_failed = speculation_failed;
+    lex_parallel_free_chunks(compiler, chunks, total_chunks, total_chunks);
+    return LEXICAL_ANALYSIS_ALL_OK;
+}
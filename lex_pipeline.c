@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "compiler.h"
+#include "helpers/intern.h"
+
+// Tokens in flight between the lexer thread and the parser
+#define LEX_PIPELINE_RING_CAPACITY 4096
+// Tokens the lexer thread has handed over are dropped once this many pile up
+#define LEX_PIPELINE_WINDOW 4096
+
+// Lexes on a thread of its own. Every token is pushed into the compile process's token
+// ring once it is final, the parser pops them as it goes. An input with directives is
+// preprocessed on the thread instead, the preprocessor pushes its output into the ring
+struct lex_pipeline
+{
+    struct lex_process *process;
+    struct token_ring *ring;
+    pthread_t thread;
+    bool preprocess;
+    // Tokens of the lexer's store up to here are in the ring
+    int published;
+    // First token inside the outermost brackets still open, -1 outside of brackets. The
+    // length of their text is only known once the brackets close
+    int open;
+    struct compile_error error;
+};
+
+// Pushes the tokens from published up to but not including end into the ring
+static void lex_pipeline_publish(struct lex_pipeline *pipeline, int end)
+{
+    struct token token;
+    for (; pipeline->published < end; pipeline->published++)
+    {
+        token_store_read(pipeline->process->tokens, pipeline->published, &token);
+        token_ring_push(pipeline->ring, &token);
+    }
+}
+
+static void lex_pipeline_lex(struct lex_pipeline *pipeline)
+{
+    struct lex_process *process = pipeline->process;
+    struct token_store *tokens = process->tokens;
+    struct token *token = lex_next_token(process);
+    while (token)
+    {
+        int index = token_store_push(tokens, token);
+        if (process->current_expression_count == 0)
+        {
+            pipeline->open = -1;
+        }
+        else if (pipeline->open < 0 && tokens->brackets[index])
+        {
+            pipeline->open = index;
+        }
+
+        // The lexer may still change the last token it made, the ones before it are final
+        // unless their brackets are still open
+        int end = tokens->count - 1;
+        if (pipeline->open >= 0 && pipeline->open < end)
+        {
+            end = pipeline->open;
+        }
+        lex_pipeline_publish(pipeline, end);
+
+        if (pipeline->published >= LEX_PIPELINE_WINDOW)
+        {
+            token_store_discard(tokens, pipeline->published);
+            if (pipeline->open >= 0)
+            {
+                pipeline->open -= pipeline->published;
+            }
+            pipeline->published = 0;
+        }
+        token = lex_next_token(process);
+    }
+
+    lex_end(process);
+}
+
+static void *lex_pipeline_run(void *arg)
+{
+    struct lex_pipeline *pipeline = arg;
+    // Errors reach the parser through the ring, after the tokens lexed before them
+    compiler_catch_errors(&pipeline->error);
+    if (setjmp(pipeline->error.caught) == 0)
+    {
+        if (pipeline->preprocess)
+        {
+            preprocess(pipeline->process, pipeline->ring);
+        }
+        else
+        {
+            lex_pipeline_lex(pipeline);
+        }
+    }
+    else
+    {
+        pipeline->ring->error = &pipeline->error;
+    }
+    compiler_catch_errors(NULL);
+
+    // The preprocessor's output is in the ring already, the lexer's store holds the input
+    if (!pipeline->preprocess)
+    {
+        lex_pipeline_publish(pipeline, pipeline->process->tokens->count);
+    }
+    token_ring_close(pipeline->ring);
+    return NULL;
+}
+
+struct lex_pipeline *lex_pipeline_start(struct lex_process *process, bool preprocess)
+{
+    struct compile_process *compiler = process->compiler;
+    struct lex_pipeline *pipeline = calloc(1, sizeof(struct lex_pipeline));
+    pipeline->process = process;
+    pipeline->preprocess = preprocess;
+    pipeline->ring = token_ring_create(LEX_PIPELINE_RING_CAPACITY);
+    pipeline->open = -1;
+
+    // The keyword and operator lexemes are interned here, before the parser reads tokens
+    lex_begin(process);
+    intern_table_set_concurrent(compiler->interned, true);
+    compiler->token_ring = pipeline->ring;
+    pthread_create(&pipeline->thread, NULL, lex_pipeline_run, pipeline);
+    return pipeline;
+}
+
+void lex_pipeline_join(struct lex_pipeline *pipeline)
+{
+    struct compile_process *compiler = pipeline->process->compiler;
+    pthread_join(pipeline->thread, NULL);
+    intern_table_set_concurrent(compiler->interned, false);
+    compiler->token_ring = NULL;
+    token_ring_free(pipeline->ring);
+    free(pipeline->error.message);
+    free(pipeline);
+}
@@ -1,14 +1,16 @@
+#include <assert.h>
 #include <stdlib.h>
 #include "helpers/vector.h"
+#include "helpers/buffer.h"
 #include "compiler.h"
 
 struct lex_process *lex_process_create(struct compile_process *compiler, struct lex_process_functions *functions, void *private)
 {
     struct lex_process *process = calloc(1, sizeof(struct lex_process));
 
-    process->pos.line = 1;
-    process->pos.column = 1;
-    process->token_vec = vector_create(sizeof(struct token));
+    process->tokens = token_store_create(compiler);
+    process->lexeme_buffer = buffer_create();
+    process->lexemes = compiler->lexemes;
     process->compiler = compiler;
     process->function = functions;
     process->private = private;
@@ -18,7 +20,8 @@ struct lex_process *lex_process_create(struct compile_process *compiler, struct
 
 void lex_process_free(struct lex_process *process)
 {
-    vector_free(process->token_vec);
+    token_store_free(process->tokens);
+    buffer_free(process->lexeme_buffer);
     free(process);
 }
 
@@ -27,7 +30,45 @@ void *lex_process_private(struct lex_process *process)
     return process->private;
 }
 
-struct vector *lex_process_tokens(struct lex_process *process)
+struct token_store *lex_process_tokens(struct lex_process *process)
 {
-    return process->token_vec;
-}
\ No newline at end of file
+    return process->tokens;
+}
+
+// Returns unread input as one span of at least min characters, unless the input ends first.
+// The span may end before the input does, callers peek again once they've skipped past it
+struct lex_process_span lex_process_peek_span(struct lex_process *process, size_t min)
+{
+    assert(min <= LEX_PROCESS_LOOKAHEAD_SIZE);
+    if (process->function->peek_span)
+    {
+        return process->function->peek_span(process, min);
+    }
+
+    // Adapter for sources that only provide single character callbacks
+    while (process->lookahead_len < min)
+    {
+        char c = process->function->next_char(process);
+        if (c == EOF)
+        {
+            break;
+        }
+
+        process->lookahead[process->lookahead_len++] = c;
+    }
+
+    return (struct lex_process_span){.ptr = process->lookahead, .len = process->lookahead_len};
+}
+
+void lex_process_skip_span(struct lex_process *process, size_t amount)
+{
+    if (process->function->skip_span)
+    {
+        process->function->skip_span(process, amount);
+        return;
+    }
+
+    assert(amount <= process->lookahead_len);
+    process->lookahead_len -= amount;
+    memmove(process->lookahead, process->lookahead + amount, process->lookahead_len);
+}
@@ -2,19 +2,158 @@
 #include "string.h"
 #include "helpers/vector.h"
 #include "helpers/buffer.h"
+#include "helpers/intern.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
+#include "helpers/decimal.h"
 
 #include <assert.h>
 #include <ctype.h>
-
-#define LEX_GETC_IF(buffer, c, expression)     \
-    for (c = peekc(); expression; c = peekc()) \
-    {                                          \
-        buffer_write(buffer, c);               \
-        nextc();                               \
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <setjmp.h>
+#include <pthread.h>
+
+// Consumes characters while expression holds for c, scanning whole spans of the input
+// at a time. c is left holding the first character that failed, or EOF
+#define LEX_GETC_IF(buffer, c, expression)                                  \
+    while (true)                                                            \
+    {                                                                       \
+        struct lex_process_span span = lex_span(1);                         \
+        size_t span_index = 0;                                              \
+        c = EOF;                                                            \
+        while (span_index < span.len && (c = span.ptr[span_index], (expression))) \
+        {                                                                   \
+            span_index++;                                                   \
+        }                                                                   \
+        buffer_write_bytes(buffer, span.ptr, span_index);                   \
+        lex_skip(span_index);                                               \
+        if (span_index < span.len || span.len == 0)                         \
+        {                                                                   \
+            break;                                                          \
+        }                                                                   \
     }
 
-static struct lex_process *lex_process;
-static struct token temp_token;
+#define LEX_CHAR_DIGIT_CLASS (LEX_CHAR_DIGIT | LEX_CHAR_HEX | LEX_CHAR_IDENTIFIER)
+#define LEX_CHAR_HEX_LETTER_CLASS (LEX_CHAR_START_IDENTIFIER | LEX_CHAR_HEX | LEX_CHAR_IDENTIFIER)
+#define LEX_CHAR_LETTER_CLASS (LEX_CHAR_START_IDENTIFIER | LEX_CHAR_IDENTIFIER)
+
+static const unsigned short lex_char_class[256] = {
+    ['0' ... '9'] = LEX_CHAR_START_NUMBER | LEX_CHAR_DIGIT_CLASS,
+    ['a' ... 'f'] = LEX_CHAR_HEX_LETTER_CLASS,
+    ['g' ... 'z'] = LEX_CHAR_LETTER_CLASS,
+    ['A' ... 'F'] = LEX_CHAR_HEX_LETTER_CLASS,
+    ['G' ... 'Z'] = LEX_CHAR_LETTER_CLASS,
+    ['_'] = LEX_CHAR_LETTER_CLASS,
+
+    ['+'] = LEX_CHAR_START_OPERATOR,
+    ['-'] = LEX_CHAR_START_OPERATOR,
+    ['>'] = LEX_CHAR_START_OPERATOR,
+    ['<'] = LEX_CHAR_START_OPERATOR,
+    ['^'] = LEX_CHAR_START_OPERATOR,
+    ['%'] = LEX_CHAR_START_OPERATOR,
+    ['!'] = LEX_CHAR_START_OPERATOR,
+    ['='] = LEX_CHAR_START_OPERATOR,
+    ['~'] = LEX_CHAR_START_OPERATOR,
+    ['|'] = LEX_CHAR_START_OPERATOR,
+    ['&'] = LEX_CHAR_START_OPERATOR,
+    ['*'] = LEX_CHAR_START_OPERATOR,
+    ['('] = LEX_CHAR_START_OPERATOR,
+    ['['] = LEX_CHAR_START_OPERATOR,
+    [','] = LEX_CHAR_START_OPERATOR,
+    ['.'] = LEX_CHAR_START_OPERATOR,
+    ['?'] = LEX_CHAR_START_OPERATOR,
+    ['/'] = LEX_CHAR_START_OPERATOR,
+
+    ['{'] = LEX_CHAR_START_SYMBOL,
+    ['}'] = LEX_CHAR_START_SYMBOL,
+    ['#'] = LEX_CHAR_START_SYMBOL,
+    [':'] = LEX_CHAR_START_SYMBOL,
+    [';'] = LEX_CHAR_START_SYMBOL,
+    [']'] = LEX_CHAR_START_SYMBOL,
+    [')'] = LEX_CHAR_START_SYMBOL,
+    ['\\'] = LEX_CHAR_START_SYMBOL,
+
+    ['"'] = LEX_CHAR_START_STRING,
+    ['\''] = LEX_CHAR_START_QUOTE,
+    [' '] = LEX_CHAR_START_WHITESPACE,
+    ['\t'] = LEX_CHAR_START_WHITESPACE,
+    ['\n'] = LEX_CHAR_START_NEWLINE};
+
+static inline bool lex_char_is(char c, unsigned short char_class)
+{
+    return lex_char_class[(unsigned char)c] & char_class;
+}
+
+// Every operator the lexer understands, the automaton in read_op is built from this table
+static const char *lex_operators[TOTAL_OPERATORS] = {
+    [OPERATOR_PLUS] = "+",
+    [OPERATOR_MINUS] = "-",
+    [OPERATOR_MULTIPLY] = "*",
+    [OPERATOR_DIVIDE] = "/",
+    [OPERATOR_MODULO] = "%",
+    [OPERATOR_LOGICAL_NOT] = "!",
+    [OPERATOR_BITWISE_XOR] = "^",
+    [OPERATOR_BITWISE_NOT] = "~",
+    [OPERATOR_BITWISE_AND] = "&",
+    [OPERATOR_BITWISE_OR] = "|",
+    [OPERATOR_LOGICAL_AND] = "&&",
+    [OPERATOR_LOGICAL_OR] = "||",
+    [OPERATOR_LEFT_SHIFT] = "<<",
+    [OPERATOR_RIGHT_SHIFT] = ">>",
+    [OPERATOR_LESS] = "<",
+    [OPERATOR_LESS_EQUAL] = "<=",
+    [OPERATOR_GREATER] = ">",
+    [OPERATOR_GREATER_EQUAL] = ">=",
+    [OPERATOR_EQUAL] = "==",
+    [OPERATOR_NOT_EQUAL] = "!=",
+    [OPERATOR_ASSIGN] = "=",
+    [OPERATOR_ADD_ASSIGN] = "+=",
+    [OPERATOR_SUBTRACT_ASSIGN] = "-=",
+    [OPERATOR_MULTIPLY_ASSIGN] = "*=",
+    [OPERATOR_DIVIDE_ASSIGN] = "/=",
+    [OPERATOR_MODULO_ASSIGN] = "%=",
+    [OPERATOR_LEFT_SHIFT_ASSIGN] = "<<=",
+    [OPERATOR_RIGHT_SHIFT_ASSIGN] = ">>=",
+    [OPERATOR_AND_ASSIGN] = "&=",
+    [OPERATOR_XOR_ASSIGN] = "^=",
+    [OPERATOR_OR_ASSIGN] = "|=",
+    [OPERATOR_INCREMENT] = "++",
+    [OPERATOR_DECREMENT] = "--",
+    [OPERATOR_ARROW] = "->",
+    [OPERATOR_LEFT_PARENTHESIS] = "(",
+    [OPERATOR_LEFT_BRACKET] = "[",
+    [OPERATOR_COMMA] = ",",
+    [OPERATOR_DOT] = ".",
+    [OPERATOR_ELLIPSIS] = "...",
+    [OPERATOR_QUESTION] = "?"};
+
+// Trie over lex_operators, state 0 is the root so a zero transition means no operator
+// continues with that character
+static struct lex_operator_state
+{
+    unsigned char next[128];
+    int op;
+} lex_operator_states[MAX_OPERATOR_STATES];
+static int lex_operator_total_states = 0;
+static pthread_once_t lex_tables_once = PTHREAD_ONCE_INIT;
+
+// Each thread lexes through its own lex process
+static _Thread_local struct lex_process *lex_process;
+static _Thread_local struct token temp_token;
+
+// Errors met while lexing speculatively give up on the speculation rather than the compile
+#define lex_error(...)                                                                      \
+    do                                                                                      \
+    {                                                                                       \
+        if (lex_process->speculation_failed)                                                \
+        {                                                                                   \
+            longjmp(*lex_process->speculation_failed, 1);                                   \
+        }                                                                                   \
+        compiler_set_diagnostic_offset(lex_process->base + lex_process->offset);            \
+        compiler_error(lex_process->compiler, __VA_ARGS__);                                 \
+    } while (0)
 
 struct token *read_next_token();
 
@@ -23,31 +162,34 @@ bool lex_is_in_expression()
     return lex_process->current_expression_count > 0;
 }
 
-static char peekc()
+static struct lex_process_span lex_span(size_t min)
 {
-    return lex_process->function->peek_char(lex_process);
+    return lex_process_peek_span(lex_process, min);
 }
 
-static void pushc(char c)
+// Consumes amount characters of a span previously returned by lex_span
+static void lex_skip(size_t amount)
 {
-    lex_process->function->push_char(lex_process, c);
+    lex_process->offset += amount;
+    lex_process_skip_span(lex_process, amount);
 }
 
-static char nextc()
+static char peekc()
 {
-    char c = lex_process->function->next_char(lex_process);
-    if (lex_is_in_expression())
-    {
-        buffer_write(lex_process->parentheses_buffer, c);
-    }
+    struct lex_process_span span = lex_span(1);
+    return span.len ? span.ptr[0] : EOF;
+}
 
-    lex_process->pos.column += 1;
-    if (c == '\n')
+static char nextc()
+{
+    struct lex_process_span span = lex_span(1);
+    if (!span.len)
     {
-        lex_process->pos.line += 1;
-        lex_process->pos.column = 1;
+        return EOF;
     }
 
+    char c = span.ptr[0];
+    lex_skip(1);
     return c;
 }
 
@@ -58,128 +200,448 @@ static char assert_next_character(char c)
     return nextc();
 }
 
-static struct position lex_file_position()
-{
-    return lex_process->pos;
-}
-
 struct token *token_create(struct token *_token)
 {
     memcpy(&temp_token, _token, sizeof(struct token));
-    temp_token.pos = lex_file_position();
+    temp_token.offset = lex_process->token_offset;
+    temp_token.length = lex_process->offset - lex_process->token_offset;
     if (lex_is_in_expression())
     {
-        temp_token.between_brackets = buffer_ptr(lex_process->parentheses_buffer);
+        temp_token.between_brackets.offset = lex_process->expression_offset;
     }
     return &temp_token;
 }
 
-static struct token *lexer_last_token()
+// Reads the last token into token, returns false when there is none
+static bool lexer_last_token(struct token *token)
 {
-    return vector_back_or_null(lex_process->token_vec);
+    struct token_store *tokens = lex_process->tokens;
+    if (!tokens->count)
+    {
+        return false;
+    }
+
+    token_store_read(tokens, tokens->count - 1, token);
+    return true;
+}
+
+// Gives the outermost expression the length of its text, now that it ends
+static void lex_close_expression_span(size_t end_offset)
+{
+    token_store_close_span(lex_process->tokens, lex_process->expression_offset, end_offset);
 }
 
 static void lex_finish_expression()
 {
     lex_process->current_expression_count--;
+    if (lex_process->current_expression_count < 0 && lex_process->speculation_failed)
+    {
+        // Lexing speculatively from the middle of the input, the bracket may have been
+        // opened before the point lexing started from
+        lex_process->current_expression_count = 0;
+        lex_process->unmatched_close = true;
+        return;
+    }
+
     if (lex_process->current_expression_count < 0)
     {
-        compiler_error(lex_process->compiler, "Closed an expression that was never opened");
+        lex_error("Closed an expression that was never opened");
+    }
+
+    if (lex_process->current_expression_count == 0)
+    {
+        // The closing bracket has been read already
+        lex_close_expression_span(lex_process->offset - 1);
     }
 }
 
 struct token *handle_whitespace()
 {
-    struct token *last_token = lexer_last_token();
-    if (last_token)
+    struct token_store *tokens = lex_process->tokens;
+    if (tokens->count)
+    {
+        token_store_set_whitespace(tokens, tokens->count - 1, true);
+    }
+    else
     {
-        last_token->whitespace = true;
+        lex_process->leading_whitespace = true;
+    }
+
+    // The whole run of blanks is skipped at once
+    while (true)
+    {
+        struct lex_process_span span = lex_span(1);
+        size_t blanks = scan.skip_blanks(span.ptr, span.len);
+        lex_skip(blanks);
+        if (blanks < span.len || span.len == 0)
+        {
+            break;
+        }
     }
 
-    nextc();
     return read_next_token();
 }
 
-const char *read_number_str()
+// Returns the lexer's scratch buffer emptied, lexemes are gathered here while they're read
+static struct buffer *lex_lexeme_buffer()
 {
-    const char *num = NULL;
-    struct buffer *buffer = buffer_create();
+    struct buffer *buffer = lex_process->lexeme_buffer;
+    buffer_clear(buffer);
+    return buffer;
+}
+
+// Copies the gathered lexeme into the lex process's arena
+static const char *lex_lexeme_copy(struct buffer *buffer)
+{
+    return arena_strndup(lex_process->lexemes, buffer_ptr(buffer), buffer->len);
+}
+
+// Gathers characters into the buffer up to the first a or b, which is returned but left in
+// the input. Returns EOF when the input ends first
+static char lex_gather_until(struct buffer *buffer, char a, char b)
+{
+    while (true)
+    {
+        struct lex_process_span span = lex_span(1);
+        if (!span.len)
+        {
+            return EOF;
+        }
+
+        size_t amount = scan.find_either(span.ptr, span.len, a, b);
+        char c = amount < span.len ? span.ptr[amount] : EOF;
+        buffer_write_bytes(buffer, span.ptr, amount);
+        lex_skip(amount);
+        if (c != EOF)
+        {
+            return c;
+        }
+    }
+}
+
+// Value of c as a digit, 16 or more when it isn't one in any base
+static inline unsigned int lex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+
+    c |= 0x20;
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : 16;
+}
+
+// Reads eight decimal digits at once into value, or returns false when some of them
+// aren't digits
+static inline bool lex_eight_digits(const char *ptr, uint32_t *value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t chunk;
+    memcpy(&chunk, ptr, sizeof(chunk));
+    // Every byte is in '0' to '9' when its high nibble is 3, and still is after adding 6
+    if (((chunk & 0xF0F0F0F0F0F0F0F0) | (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) != 0x3333333333333333)
+    {
+        return false;
+    }
+
+    // Pairs of digits are combined into 2 digit numbers, then 4, then 8
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0F) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FF) * 6553601) >> 16;
+    *value = ((chunk & 0x0000FFFF0000FFFF) * 42949672960001) >> 32;
+    return true;
+#else
+    return false;
+#endif
+}
+
+// A number's digits as they are read. They build value until it would overflow, the
+// digits after that are only kept in the lexeme buffer
+struct lex_number
+{
+    unsigned int base;
+    unsigned long long value;
+    // Power of the base, of two for hexadecimal, that value is scaled by
+    int exponent;
+    int total_digits;
+    // Digits that didn't fit in value
+    int spilled;
+
+    // Constants starting with 0 are octal unless they turn out to be floating, so their
+    // octal value is built alongside
+    bool octal;
+    bool octal_overflow;
+    unsigned long long octal_value;
+    char invalid_octal_digit;
+};
+
+// The largest value eight more decimal digits can be added to without overflowing
+#define LEX_NUMBER_EIGHT_DIGITS_LIMIT ((ULLONG_MAX - 99999999) / 100000000)
+// Bounds explicit exponents, anything past this is zero or infinity anyway
+#define LEX_NUMBER_EXPONENT_LIMIT 100000
+
+static void lex_number_push(struct lex_number *number, char c, unsigned int digit, bool fraction)
+{
+    if (digit >= number->base)
+    {
+        lex_error("Invalid digit %c in a base %u constant", c, number->base);
+    }
+
+    if (number->octal)
+    {
+        if (digit >= 8 && !number->invalid_octal_digit)
+        {
+            number->invalid_octal_digit = c;
+        }
+        number->octal_overflow |= number->octal_value >> 61 != 0;
+        number->octal_value = number->octal_value << 3 | (digit & 7);
+    }
+
+    int step = number->base == 16 ? 4 : 1;
+    number->total_digits++;
+    unsigned long long value = 0;
+    if (!number->spilled && !__builtin_mul_overflow(number->value, number->base, &value) && !__builtin_add_overflow(value, digit, &value))
+    {
+        number->value = value;
+        number->exponent -= fraction ? step : 0;
+        return;
+    }
+
+    // Too many digits for value, the slow path reads them back from the buffer
+    buffer_write(lex_process->lexeme_buffer, c);
+    number->spilled++;
+    number->exponent += fraction ? 0 : step;
+}
+
+// Reads the digits of a number's integer or fraction part. Decimal digits are read in any
+// base below ten so that binary constants with a digit out of range are reported rather
+// than split
+static void lex_number_digits(struct lex_number *number, bool fraction)
+{
+    unsigned int accepted = number->base == 16 ? 16 : 10;
+    while (true)
+    {
+        struct lex_process_span span = lex_span(1);
+        size_t index = 0;
+        uint32_t eight = 0;
+        while (number->base == 10 && !number->octal && !number->spilled && number->value <= LEX_NUMBER_EIGHT_DIGITS_LIMIT &&
+               index + 8 <= span.len && lex_eight_digits(span.ptr + index, &eight))
+        {
+            number->value = number->value * 100000000 + eight;
+            number->exponent -= fraction ? 8 : 0;
+            number->total_digits += 8;
+            index += 8;
+        }
+
+        for (; index < span.len; index++)
+        {
+            unsigned int digit = lex_digit_value(span.ptr[index]);
+            if (digit >= accepted)
+            {
+                break;
+            }
+            lex_number_push(number, span.ptr[index], digit, fraction);
+        }
+
+        lex_skip(index);
+        if (index < span.len || span.len == 0)
+        {
+            break;
+        }
+    }
+}
+
+// Consumes c when it is the next character, in either case
+static bool lex_skip_if(char c)
+{
+    struct lex_process_span span = lex_span(1);
+    if (!span.len || (span.ptr[0] != c && span.ptr[0] != toupper(c)))
+    {
+        return false;
+    }
+
+    lex_skip(1);
+    return true;
+}
+
+// Reads the u, l and ll suffixes in either order. An l of ll has to match the case of
+// the first
+static int lex_integer_suffix()
+{
+    int flags = 0;
+    if (lex_skip_if('u'))
+    {
+        flags |= NUMBER_FLAG_UNSIGNED;
+    }
+
+    struct lex_process_span span = lex_span(2);
+    if (span.len && (span.ptr[0] | 0x20) == 'l')
+    {
+        bool long_long = span.len > 1 && span.ptr[1] == span.ptr[0];
+        flags |= long_long ? NUMBER_FLAG_LONG_LONG : NUMBER_FLAG_LONG;
+        lex_skip(long_long ? 2 : 1);
+        if (!(flags & NUMBER_FLAG_UNSIGNED) && lex_skip_if('u'))
+        {
+            flags |= NUMBER_FLAG_UNSIGNED;
+        }
+    }
+
+    return flags;
+}
+
+// Reads the signed exponent after an e or p
+static int lex_floating_exponent()
+{
+    bool negative = false;
     char c = peekc();
-    LEX_GETC_IF(buffer, c, (c >= '0' && c <= '9'));
-
-    buffer_write(buffer, 0x00);
-    return buffer_ptr(buffer);
-}
-
-unsigned long long read_number()
-{
-    const char *s = read_number_str();
-    return atoll(s);
-}
-
-bool iskeyword(const char *str)
-{
-    return S_EQ(str, "unsigned") ||
-           S_EQ(str, "signed") ||
-           S_EQ(str, "char") ||
-           S_EQ(str, "short") ||
-           S_EQ(str, "int") ||
-           S_EQ(str, "long") ||
-           S_EQ(str, "float") ||
-           S_EQ(str, "double") ||
-           S_EQ(str, "void") ||
-           S_EQ(str, "struct") ||
-           S_EQ(str, "union") ||
-           S_EQ(str, "static") ||
-           S_EQ(str, "__ignore_typecheck") ||
-           S_EQ(str, "return") ||
-           S_EQ(str, "include") ||
-           S_EQ(str, "sizeof") ||
-           S_EQ(str, "if") ||
-           S_EQ(str, "else") ||
-           S_EQ(str, "while") ||
-           S_EQ(str, "for") ||
-           S_EQ(str, "do") ||
-           S_EQ(str, "break") ||
-           S_EQ(str, "continue") ||
-           S_EQ(str, "switch") ||
-           S_EQ(str, "case") ||
-           S_EQ(str, "default") ||
-           S_EQ(str, "goto") ||
-           S_EQ(str, "typedef") ||
-           S_EQ(str, "const") ||
-           S_EQ(str, "extern") ||
-           S_EQ(str, "restrict");
-}
-
-struct token *token_make_number_for_value(unsigned long number)
-{
-    return token_create(&(struct token){.type = TOKEN_TYPE_NUMBER, .llnum = number});
+    if (c == '+' || c == '-')
+    {
+        negative = c == '-';
+        nextc();
+    }
+
+    if (lex_digit_value(peekc()) >= 10)
+    {
+        lex_error("Expected a digit in the exponent of a floating constant");
+    }
+
+    int exponent = 0;
+    while (lex_digit_value(peekc()) < 10)
+    {
+        exponent = exponent * 10 + nextc() - '0';
+        if (exponent > LEX_NUMBER_EXPONENT_LIMIT)
+        {
+            exponent = LEX_NUMBER_EXPONENT_LIMIT;
+        }
+    }
+
+    return negative ? -exponent : exponent;
 }
 
-struct token *token_make_number()
+// Works out a floating constant's value from its digits. Only constants whose dropped
+// digits could change the result, and hexadecimal ones that round twice, are converted
+// again from their text
+static double lex_floating_value(struct lex_number *number)
 {
-    return token_make_number_for_value(read_number());
+    if (number->base == 10)
+    {
+        // Dropped digits put the value between value and value + 1, scaled
+        double value = decimal_to_double(number->value, number->exponent);
+        if (!number->spilled || (number->value != ULLONG_MAX && value == decimal_to_double(number->value + 1, number->exponent)))
+        {
+            return value;
+        }
+    }
+    else if (!number->spilled)
+    {
+        // value only rounds when it has more than 53 bits, ldexp only rounds when the
+        // result is subnormal
+        double value = ldexp((double)number->value, number->exponent);
+        if (number->value < 1ULL << 53 || value == 0 || fabs(value) >= DBL_MIN)
+        {
+            return value;
+        }
+    }
+
+    int scale = number->base == 16 ? 4 : 1;
+    char *text = malloc(number->spilled + 64);
+    sprintf(text, number->base == 16 ? "0x%llx%.*sp%d" : "%llu%.*se%d", number->value, number->spilled,
+            (const char *)buffer_ptr(lex_process->lexeme_buffer), number->exponent - number->spilled * scale);
+    double value = strtod(text, NULL);
+    free(text);
+    return value;
 }
 
-struct token *token_make_string(char start_delimiter, char end_delimiter)
+// Reads the rest of a floating constant once its integer part has been read
+static struct token *token_make_floating(struct lex_number *number)
 {
-    struct buffer *buffer = buffer_create();
-    assert(nextc() == start_delimiter);
-    char c = nextc();
-    for (; c != end_delimiter && c != EOF; c = nextc())
+    if (lex_skip_if('.'))
+    {
+        lex_number_digits(number, true);
+    }
+
+    if (!number->total_digits)
+    {
+        lex_error("Expected a digit in the floating constant");
+    }
+
+    if (lex_skip_if(number->base == 16 ? 'p' : 'e'))
+    {
+        number->exponent += lex_floating_exponent();
+    }
+    else if (number->base == 16)
+    {
+        lex_error("Hexadecimal floating constants need an exponent");
+    }
+
+    int flags = NUMBER_FLAG_FLOATING;
+    if (lex_skip_if('f'))
+    {
+        flags |= NUMBER_FLAG_FLOAT;
+    }
+    else if (lex_skip_if('l'))
     {
-        if (c == '\\')
+        flags |= NUMBER_FLAG_LONG;
+    }
+
+    return token_create(&(struct token){.type = TOKEN_TYPE_NUMBER, .flags = flags, .dval = lex_floating_value(number)});
+}
+
+// Reads a number in one pass, its value is worked out as the digits are read
+struct token *token_make_number()
+{
+    struct lex_number number = {.base = 10};
+    lex_lexeme_buffer();
+    struct lex_process_span span = lex_span(2);
+    if (span.ptr[0] == '0' && span.len > 1 && ((span.ptr[1] | 0x20) == 'x' || (span.ptr[1] | 0x20) == 'b'))
+    {
+        char prefix = span.ptr[1] | 0x20;
+        number.base = prefix == 'x' ? 16 : 2;
+        lex_skip(2);
+        // Hexadecimal floating constants may start with the point
+        char c = peekc();
+        if (lex_digit_value(c) >= (number.base == 16 ? 16 : 10) && (number.base != 16 || c != '.'))
         {
-            // Implement code for line break
-            continue;
+            lex_error("Expected a digit after 0%c", prefix);
         }
+    }
+    else
+    {
+        number.octal = span.ptr[0] == '0';
+    }
+
+    lex_number_digits(&number, false);
+    char c = peekc();
+    if ((number.base == 10 && (c == '.' || c == 'e' || c == 'E')) || (number.base == 16 && (c == '.' || c == 'p' || c == 'P')))
+    {
+        return token_make_floating(&number);
+    }
+
+    if (number.octal ? number.octal_overflow : number.spilled)
+    {
+        lex_error("Integer constant is too large");
+    }
+
+    if (number.invalid_octal_digit)
+    {
+        lex_error("Invalid digit %c in octal constant", number.invalid_octal_digit);
+    }
 
-        buffer_write(buffer, c);
+    unsigned long long value = number.octal ? number.octal_value : number.value;
+    return token_create(&(struct token){.type = TOKEN_TYPE_NUMBER, .flags = lex_integer_suffix(), .llnum = value});
+}
+
+struct token *token_make_string(char start_delimiter, char end_delimiter)
+{
+    struct buffer *buffer = lex_lexeme_buffer();
+    assert(nextc() == start_delimiter);
+    while (lex_gather_until(buffer, end_delimiter, '\\') == '\\')
+    {
+        // Implement code for line break
+        nextc();
     }
+    nextc();
 
-    buffer_write(buffer, 0x00);
-    return token_create(&(struct token){.type = TOKEN_TYPE_STRING, .sval = buffer_ptr(buffer)});
+    return token_create(&(struct token){.type = TOKEN_TYPE_STRING, .sval = lex_lexeme_copy(buffer)});
 }
 
 struct token *token_make_newline()
@@ -188,116 +650,98 @@ struct token *token_make_newline()
     return token_create(&(struct token){.type = TOKEN_TYPE_NEWLINE});
 }
 
-static bool op_treat_as_one(char c)
-{
-    return c == '(' || c == '[' || c == ',' || c == '*' || c == '.' || c == '?';
-}
-
-static bool is_single_operator(char op)
-{
-    return op == '+' ||
-           op == '-' ||
-           op == '/' ||
-           op == '*' ||
-           op == '=' ||
-           op == '>' ||
-           op == '<' ||
-           op == '|' ||
-           op == '&' ||
-           op == '^' ||
-           op == '%' ||
-           op == '~' ||
-           op == '!' ||
-           op == '(' ||
-           op == '[' ||
-           op == ',' ||
-           op == '.' ||
-           op == '?';
-}
-
-static bool is_operator_valid(const char *op)
-{
-    return S_EQ(op, "+") ||
-           S_EQ(op, "-") ||
-           S_EQ(op, "*") ||
-           S_EQ(op, "/") ||
-           S_EQ(op, "!") ||
-           S_EQ(op, "^") ||
-           S_EQ(op, "+=") ||
-           S_EQ(op, "-=") ||
-           S_EQ(op, "*=") ||
-           S_EQ(op, "/=") ||
-           S_EQ(op, ">>") ||
-           S_EQ(op, "<<") ||
-           S_EQ(op, ">=") ||
-           S_EQ(op, "<=") ||
-           S_EQ(op, ">") ||
-           S_EQ(op, "<") ||
-           S_EQ(op, "||") ||
-           S_EQ(op, "&&") ||
-           S_EQ(op, "|") ||
-           S_EQ(op, "&") ||
-           S_EQ(op, "++") ||
-           S_EQ(op, "--") ||
-           S_EQ(op, "=") ||
-           S_EQ(op, "!=") ||
-           S_EQ(op, "==") ||
-           S_EQ(op, "->") ||
-           S_EQ(op, "(") ||
-           S_EQ(op, "[") ||
-           S_EQ(op, ",") ||
-           S_EQ(op, ".") ||
-           S_EQ(op, "...") ||
-           S_EQ(op, "~") ||
-           S_EQ(op, "?") ||
-           S_EQ(op, "%");
-}
-
-void read_op_flush_back_keep_first(struct buffer *buffer)
-{
-    const char *data = buffer_ptr(buffer);
-    int len = buffer->len;
-    for (int i = len - 1; i > 0; i--)
-    {
-        if (data[i] == 0x00)
-            continue;
-        pushc(data[i]);
-    }
-}
-
-const char *read_op()
-{
-    bool single_op = true;
-    char op = nextc();
-    struct buffer *buffer = buffer_create();
-    buffer_write(buffer, op);
-
-    if (!op_treat_as_one(op))
-    {
-        op = peekc();
-        if (is_single_operator(op))
+static void lex_build_operator_states()
+{
+    lex_operator_total_states = 1;
+    for (int op = OPERATOR_NONE + 1; op < TOTAL_OPERATORS; op++)
+    {
+        int state = 0;
+        for (const char *c = lex_operators[op]; *c; c++)
         {
-            buffer_write(buffer, op);
-            nextc();
-            single_op = false;
+            if (!lex_operator_states[state].next[(unsigned char)*c])
+            {
+                assert(lex_operator_total_states < MAX_OPERATOR_STATES);
+                lex_operator_states[state].next[(unsigned char)*c] = lex_operator_total_states++;
+            }
+            state = lex_operator_states[state].next[(unsigned char)*c];
+        }
+        lex_operator_states[state].op = op;
+    }
+}
+
+// Tables shared by every lex process, built once whichever thread gets there first
+static void lex_build_tables()
+{
+    lex_build_operator_states();
+    scan_select();
+}
+
+// Interns the text of every operator and keyword once per compile process, before any
+// lexing starts on other threads
+static void lex_intern_fixed_lexemes()
+{
+    struct compile_process *compiler = lex_process->compiler;
+    if (compiler->operators[OPERATOR_PLUS])
+    {
+        return;
+    }
+
+    for (int op = OPERATOR_NONE + 1; op < TOTAL_OPERATORS; op++)
+    {
+        compiler->operators[op] = intern(compiler->interned, lex_operators[op], strlen(lex_operators[op]));
+    }
+
+    for (int keyword = KEYWORD_NONE + 1; keyword <= TOTAL_KEYWORDS; keyword++)
+    {
+        compiler->keywords[keyword] = intern(compiler->interned, keyword_string(keyword), strlen(keyword_string(keyword)));
+    }
+}
+
+// The OPERATOR_ value of the text of an operator, OPERATOR_NONE when the lexer has no such
+// operator
+int lex_operator_lookup(const char *str)
+{
+    for (int op = OPERATOR_NONE + 1; op < TOTAL_OPERATORS; op++)
+    {
+        if (S_EQ(lex_operators[op], str))
+        {
+            return op;
         }
     }
 
-    buffer_write(buffer, 0x00);
-    char *ptr = buffer_ptr(buffer);
-    if (!single_op)
+    return OPERATOR_NONE;
+}
+
+// Returns the longest operator at the start of the input, consuming exactly its characters
+static int read_op()
+{
+    struct lex_process_span span = lex_span(MAX_OPERATOR_LENGTH);
+    int state = 0;
+    int op = OPERATOR_NONE;
+    size_t len = 0;
+    for (size_t i = 0; i < span.len && i < MAX_OPERATOR_LENGTH; i++)
     {
-        if (!is_operator_valid(ptr))
+        unsigned char c = span.ptr[i];
+        state = c < 128 ? lex_operator_states[state].next[c] : 0;
+        if (!state)
+        {
+            break;
+        }
+
+        if (lex_operator_states[state].op != OPERATOR_NONE)
         {
-            read_op_flush_back_keep_first(buffer);
-            ptr[1] = 0x00;
+            op = lex_operator_states[state].op;
+            len = i + 1;
         }
     }
-    else if (!is_operator_valid(ptr))
+
+    if (op == OPERATOR_NONE)
     {
-        compiler_error(lex_process->compiler, "The operator %s is not valid\n", ptr);
+        lex_error("The operator %c is not valid\n", span.ptr[0]);
     }
-    return ptr;
+
+    lex_skip(len);
+    return op;
 }
 
 static void lex_new_expression()
@@ -305,25 +749,35 @@ static void lex_new_expression()
     lex_process->current_expression_count++;
     if (lex_process->current_expression_count == 1)
     {
-        lex_process->parentheses_buffer = buffer_create();
+        lex_process->expression_offset = lex_process->offset;
     }
-    // TODO: Take care of closing the buffer
 }
 
 struct token *token_make_operator_or_string()
 {
     char op = peekc();
+    if (op == '.')
+    {
+        // A point followed by a digit starts a floating constant
+        struct lex_process_span span = lex_span(2);
+        if (span.len > 1 && lex_char_is(span.ptr[1], LEX_CHAR_DIGIT))
+        {
+            return token_make_number();
+        }
+    }
+
     if (op == '<')
     {
-        struct token *last_token = lexer_last_token();
-        if (is_token_keyword(last_token, "include"))
+        struct token last_token;
+        if (lexer_last_token(&last_token) && is_token_keyword(&last_token, KEYWORD_INCLUDE))
         {
             return token_make_string('<', '>');
         }
     }
 
-    struct token *token = token_create(&(struct token){.type = TOKEN_TYPE_OPERATOR, .sval = read_op()});
-    if (op == '(')
+    int id = read_op();
+    struct token *token = token_create(&(struct token){.type = TOKEN_TYPE_OPERATOR, .op = id, .sval = lex_process->compiler->operators[id]});
+    if (id == OPERATOR_LEFT_PARENTHESIS)
     {
         lex_new_expression();
     }
@@ -342,50 +796,58 @@ struct token *token_make_symbol()
 
 struct token *token_make_keyword_or_identifier()
 {
-    struct buffer *buffer = buffer_create();
-    char c = 0;
-    LEX_GETC_IF(buffer, c, (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_');
-    buffer_write(buffer, 0x00);
+    // An identifier that ends within the span is looked up right where it is in the source.
+    // Otherwise, like at the end of a chunk of the source, it is gathered first
+    struct lex_process_span span = lex_span(1);
+    size_t len = 0;
+    while (len < span.len && lex_char_is(span.ptr[len], LEX_CHAR_IDENTIFIER))
+    {
+        len++;
+    }
 
-    if (iskeyword(buffer_ptr(buffer)))
+    const char *lexeme = span.ptr;
+    if (len == span.len)
     {
-        return token_create(&(struct token){.type = TOKEN_TYPE_KEYWORD, .sval = buffer_ptr(buffer)});
+        struct buffer *buffer = lex_lexeme_buffer();
+        char c = 0;
+        LEX_GETC_IF(buffer, c, lex_char_is(c, LEX_CHAR_IDENTIFIER));
+        lexeme = buffer_ptr(buffer);
+        len = buffer->len;
     }
 
-    return token_create(&(struct token){.type = TOKEN_TYPE_IDENTIFIER, .sval = buffer_ptr(buffer)});
-}
+    int keyword = keyword_lookup(lexeme, len);
+    const char *identifier = keyword == KEYWORD_NONE ? intern(lex_process->compiler->interned, lexeme, len) : NULL;
+    if (lexeme == span.ptr)
+    {
+        lex_skip(len);
+    }
 
-struct token *read_default_token()
-{
-    char c = peekc();
-    if (isalpha(c) || c == '_')
+    if (keyword != KEYWORD_NONE)
     {
-        return token_make_keyword_or_identifier();
+        return token_create(&(struct token){.type = TOKEN_TYPE_KEYWORD, .keyword = keyword, .sval = lex_process->compiler->keywords[keyword]});
     }
-    else
-        return NULL;
+
+    return token_create(&(struct token){.type = TOKEN_TYPE_IDENTIFIER, .sval = identifier});
 }
 
 struct token *token_make_single_line_comment()
 {
-    struct buffer *buffer = buffer_create();
-    char c = 0;
-    LEX_GETC_IF(buffer, c, c != EOF && c != '\n');
-    buffer_write(buffer, 0x00);
-    return token_create(&(struct token){.type = TOKEN_TYPE_COMMENT, .sval = buffer_ptr(buffer)});
+    struct buffer *buffer = lex_lexeme_buffer();
+    lex_gather_until(buffer, '\n', '\n');
+    return token_create(&(struct token){.type = TOKEN_TYPE_COMMENT, .sval = lex_lexeme_copy(buffer)});
 }
 
 struct token *token_make_multi_line_comment()
 {
-    struct buffer *buffer = buffer_create();
+    struct buffer *buffer = lex_lexeme_buffer();
     char c = 0;
 
     while (true)
     {
-        LEX_GETC_IF(buffer, c, c != EOF && c != '*');
+        c = lex_gather_until(buffer, '*', '*');
         if (c == EOF)
         {
-            compiler_error(lex_process->compiler, "Multiline comment not closed");
+            lex_error("Multiline comment not closed");
         }
         else if (c == '*')
         {
@@ -398,31 +860,29 @@ struct token *token_make_multi_line_comment()
         }
     }
 
-    return token_create(&(struct token){.type = TOKEN_TYPE_COMMENT, .sval = buffer_ptr(buffer)});
+    return token_create(&(struct token){.type = TOKEN_TYPE_COMMENT, .sval = lex_lexeme_copy(buffer)});
 }
 
 struct token *token_make_comment()
 {
-    char c = peekc();
-    if (c == '/')
+    struct lex_process_span span = lex_span(2);
+    if (span.len < 2 || span.ptr[0] != '/')
     {
-        nextc();
-        if (peekc() == '/')
-        {
-            nextc();
-            return token_make_single_line_comment();
-        }
-        else if (peekc() == '*')
-        {
-            nextc();
-            return token_make_multi_line_comment();
-        }
-
-        // Case: Division operator; TODO: Handle division operator
-        pushc('/');
         return NULL;
     }
 
+    if (span.ptr[1] == '/')
+    {
+        lex_skip(2);
+        return token_make_single_line_comment();
+    }
+    else if (span.ptr[1] == '*')
+    {
+        lex_skip(2);
+        return token_make_multi_line_comment();
+    }
+
+    // Division, read_op takes care of it
     return NULL;
 }
 
@@ -448,80 +908,6 @@ char lex_get_escaped_char(char c)
     return output;
 }
 
-void lexer_pop_token()
-{
-    vector_pop(lex_process->token_vec);
-}
-
-static bool is_hex_char(char c)
-{
-    c = tolower(c);
-    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
-}
-
-const char *read_hex_number_string()
-{
-    struct buffer *buffer = buffer_create();
-    char c = peekc();
-    LEX_GETC_IF(buffer, c, is_hex_char(c));
-    buffer_write(buffer, 0x00);
-    return buffer_ptr(buffer);
-}
-
-struct token *token_make_special_number_hexadecimal()
-{
-    nextc();
-    unsigned long number = 0;
-    const char *number_str = read_hex_number_string();
-    number = strtol(number_str, 0, 16);
-    return token_make_number_for_value(number);
-}
-
-void lexer_validate_binary_string(const char *str)
-{
-    size_t len = strlen(str);
-    for (int i = 0; i < len; i++)
-    {
-        if (str[i] != '0' && str[i] != '1')
-        {
-            compiler_error(lex_process->compiler, "Not a valid binary character\n");
-        }
-    }
-}
-
-struct token *token_make_special_number_binary()
-{
-    nextc();
-    unsigned long number = 0;
-    const char *num_str = read_number_str();
-    lexer_validate_binary_string(num_str);
-    number = strtol(num_str, 0, 2);
-    return token_make_number_for_value(number);
-}
-
-struct token *token_make_special_number()
-{
-    struct token *token = NULL;
-    struct token *last_token = lexer_last_token();
-    if (!last_token || last_token->type != TOKEN_TYPE_NUMBER || last_token->llnum != 0)
-    {
-        return token_make_keyword_or_identifier();
-    }
-
-    lexer_pop_token();
-    char c = peekc();
-    if (c == 'x')
-    {
-        token = token_make_special_number_hexadecimal();
-    }
-    else if (c == 'b')
-    {
-        token = token_make_special_number_binary();
-    }
-
-    return token;
-}
-
 struct token *token_make_quote()
 {
     assert_next_character('\'');
@@ -533,7 +919,7 @@ struct token *token_make_quote()
     }
     if (peekc() != '\'')
     {
-        compiler_error(lex_process->compiler, "Opened quote not closed");
+        lex_error("Opened quote not closed");
         // TODO: check why this block gets executed for 'a' and '\\'
     }
     nextc();
@@ -543,6 +929,7 @@ struct token *token_make_quote()
 struct token *read_next_token()
 {
     struct token *token = NULL;
+    lex_process->token_offset = lex_process->offset;
     char c = peekc();
     token = token_make_comment();
     if (token)
@@ -550,71 +937,94 @@ struct token *read_next_token()
         return token;
     }
 
-    switch (c)
+    if (c == EOF)
+    {
+        return NULL;
+    }
+
+    switch (lex_char_class[(unsigned char)c] & LEX_CHAR_START_MASK)
     {
-    NUMERIC_CASE:
+    case LEX_CHAR_START_NUMBER:
         token = token_make_number();
         break;
 
-    OPERATOR_CASE_EXCLUDING_DIVISION:
+    case LEX_CHAR_START_OPERATOR:
         token = token_make_operator_or_string();
         break;
 
-    SYMBOL_CASE:
+    case LEX_CHAR_START_SYMBOL:
         token = token_make_symbol();
         break;
 
-    case '"':
+    case LEX_CHAR_START_STRING:
         token = token_make_string('"', '"');
         break;
 
-    case ' ':
-    case '\t':
+    case LEX_CHAR_START_WHITESPACE:
         token = handle_whitespace();
         break;
 
-    case '\n':
+    case LEX_CHAR_START_NEWLINE:
         token = token_make_newline();
         break;
 
-    case EOF:
-        break;
-
-    case '\'':
+    case LEX_CHAR_START_QUOTE:
         token = token_make_quote();
         break;
 
-    case 'b':
-    case 'x':
-        token = token_make_special_number();
+    case LEX_CHAR_START_IDENTIFIER:
+        token = token_make_keyword_or_identifier();
         break;
 
     default:
-        token = read_default_token();
-        if (token == NULL)
-        {
-            compiler_error(lex_process->compiler, "Unexpected token\n");
-        }
-        else
-            break;
+        lex_error("Unexpected token\n");
     }
 
     return token;
 }
 
+void lex_begin(struct lex_process *process)
+{
+    lex_process = process;
+    pthread_once(&lex_tables_once, lex_build_tables);
+    lex_intern_fixed_lexemes();
+}
+
+struct token *lex_next_token(struct lex_process *process)
+{
+    lex_process = process;
+    return read_next_token();
+}
+
+void lex_end(struct lex_process *process)
+{
+    if (process->current_expression_count > 0)
+    {
+        lex_process = process;
+        lex_close_expression_span(process->offset);
+    }
+}
+
+// Moves past input without lexing it, the offsets of the tokens after it stay right
+void lex_skip_input(struct lex_process *process, size_t amount)
+{
+    process->offset += amount;
+    lex_process_skip_span(process, amount);
+}
+
 int lex(struct lex_process *process)
 {
     process->current_expression_count = 0;
-    process->parentheses_buffer = NULL;
-    process->pos.filename = process->compiler->cfile.abs_path;
+    process->offset = 0;
 
-    lex_process = process;
-    struct token *token = read_next_token();
+    lex_begin(process);
+    struct token *token = lex_next_token(process);
     while (token)
     {
-        vector_push(process->token_vec, token);
-        token = read_next_token();
+        token_store_push(process->tokens, token);
+        token = lex_next_token(process);
     }
 
+    lex_end(process);
     return LEXICAL_ANALYSIS_ALL_OK;
-}
\ No newline at end of file
+}
@@ -1,9 +1,23 @@
 #include <stdio.h>
+#include <string.h>
 #include "compiler.h"
 
-int main()
+int main(int argc, char **argv)
 {
-    int result = compile_file("./test.c", "./test", 0);
+    // -I dir and -Idir add directories to look for headers in, in the order given
+    const char *include_dirs[argc + 1];
+    int total_include_dirs = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "-I", 2))
+        {
+            const char *dir = argv[i][2] || i + 1 == argc ? argv[i] + 2 : argv[++i];
+            include_dirs[total_include_dirs++] = dir;
+        }
+    }
+    include_dirs[total_include_dirs] = NULL;
+
+    int result = compile_file_with_include_dirs("./test.c", "./test", 0, include_dirs);
 
     if (result == COMPILER_FILE_COMPILED_OK)
     {
@@ -2,8 +2,9 @@
 #include "compiler.h"
 #include "helpers/vector.h"
 
-struct vector *node_vector = NULL;
-struct vector *node_vector_root = NULL;
+// The vectors of the compile being parsed on this thread
+_Thread_local struct vector *node_vector = NULL;
+_Thread_local struct vector *node_vector_root = NULL;
 
 void node_set_vector(struct vector *vector, struct vector *vector_root)
 {
@@ -18,7 +19,7 @@ void node_push(struct node *node)
 
 struct node *node_peek_or_null()
 {
-    vector_back_ptr_or_null(node_vector);
+    return vector_back_ptr_or_null(node_vector);
 }
 
 struct node *node_peek()
@@ -65,9 +66,9 @@ struct node *node_peek_expressionable_or_null()
     return node_is_expressionable(node) ? node : NULL;
 }
 
-void node_make_expression(struct node *left, struct node *right, const char *operator)
+void node_make_expression(struct node *left, struct node *right, const char *operator, int op)
 {
     assert(left);
     assert(right);
-    node_create(&(struct node){.type = NODE_TYPE_EXPRESSION, .expression.left = left, .expression.right = right, .expression.operator = operator});
+    node_create(&(struct node){.type = NODE_TYPE_EXPRESSION, .expression.left = left, .expression.right = right, .expression.operator = operator, .expression.op = op});
 }
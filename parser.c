@@ -1,10 +1,22 @@
 #include <assert.h>
 #include "compiler.h"
 #include "helpers/vector.h"
-
-static struct compile_process *current_process;
-static struct token *parser_last_token;
+#include "helpers/intern.h"
+
+// The compile being parsed on this thread. The parser's state, and node.c's, is kept per
+// thread, so compiles on several threads are parsed at once
+static _Thread_local struct compile_process *current_process;
+static _Thread_local struct token *parser_last_token;
+// Index of the next token in the current process's token store. Tokens are read out of
+// the store into these
+static _Thread_local int parser_index;
+static _Thread_local struct token parser_next_token;
+static _Thread_local struct token parser_peek_token;
+
+// When tokens are streamed, the ones already read are dropped once this many pile up
+#define PARSER_STREAM_WINDOW 4096
 extern struct expressionable_operator_precedence_group operator_group[TOTAL_OPERATOR_GROUPS];
+extern int operator_precedence[TOTAL_OPERATORS];
 
 struct history
 {
@@ -26,29 +38,91 @@ struct history *history_down(struct history *history, int flags)
     return new_history;
 }
 
-static void parser_ignore_comment_or_newline(struct token *token)
+// Tells if there is a token at index. When streaming, tokens are pulled from the lexer up
+// to one past it, as the lexer may still change the last token it made. Tokens popped
+// from a lexer thread's ring are already final, an error the lexer thread stopped on is
+// reported once they have all been popped
+static bool parser_has_token(int index)
 {
-    while (token && token_is_comment_newline_or_newline_seperator(token))
+    struct token_store *tokens = current_process->tokens;
+    struct lex_process *source = current_process->token_source;
+    while (source && index + 1 >= tokens->count)
+    {
+        struct token *token = lex_next_token(source);
+        if (!token)
+        {
+            lex_end(source);
+            current_process->token_source = NULL;
+            break;
+        }
+        token_store_push(tokens, token);
+    }
+
+    struct token token;
+    while (current_process->token_ring && index >= tokens->count)
+    {
+        if (!token_ring_pop(current_process->token_ring, &token))
+        {
+            struct compile_error *error = current_process->token_ring->error;
+            current_process->token_ring = NULL;
+            if (error)
+            {
+                compiler_set_diagnostic_offset(error->offset);
+                compiler_error(current_process, "%s", error->message);
+            }
+            break;
+        }
+        token_store_push(tokens, &token);
+    }
+
+    return index < tokens->count;
+}
+
+// Skips comments and newlines, only the kinds and payloads of the tokens are read
+static void parser_ignore_comment_or_newline()
+{
+    struct token_store *tokens = current_process->tokens;
+    if ((current_process->token_source || current_process->token_ring) && parser_index >= PARSER_STREAM_WINDOW)
+    {
+        token_store_discard(tokens, parser_index);
+        parser_index = 0;
+    }
+
+    while (parser_has_token(parser_index))
     {
-        vector_peek(current_process->token_vec);
-        token = vector_peek_no_increment(current_process->token_vec);
+        int type = tokens->kinds[parser_index] & TOKEN_STORE_KIND_MASK;
+        if (type != TOKEN_TYPE_NEWLINE && type != TOKEN_TYPE_COMMENT &&
+            (type != TOKEN_TYPE_SYMBOL || tokens->payloads[parser_index] != '\\'))
+        {
+            break;
+        }
+        parser_index++;
     }
 }
 
 static struct token *token_next()
 {
-    struct token *next_token = vector_peek_no_increment(current_process->token_vec);
-    parser_ignore_comment_or_newline(next_token);
-    current_process->pos = next_token->pos;
-    parser_last_token = next_token;
-    return vector_peek(current_process->token_vec);
+    parser_ignore_comment_or_newline();
+    if (!parser_has_token(parser_index))
+    {
+        return NULL;
+    }
+
+    token_store_read(current_process->tokens, parser_index++, &parser_next_token);
+    parser_last_token = &parser_next_token;
+    return &parser_next_token;
 }
 
 static struct token *token_peek_next()
 {
-    struct token *token = vector_peek_no_increment(current_process->token_vec);
-    parser_ignore_comment_or_newline(token);
-    return vector_peek_no_increment(current_process->token_vec);
+    parser_ignore_comment_or_newline();
+    if (!parser_has_token(parser_index))
+    {
+        return NULL;
+    }
+
+    token_store_read(current_process->tokens, parser_index, &parser_peek_token);
+    return &parser_peek_token;
 }
 
 void parse_single_token_to_node()
@@ -71,6 +145,7 @@ void parse_single_token_to_node()
         break;
 
     default:
+        compiler_set_diagnostic_offset(current_process->tokens->offsets[parser_index - 1]);
         compiler_error(current_process, "Not a single token that is convertable to a node");
     }
 }
@@ -83,33 +158,11 @@ void parse_expressionable_for_operator(struct history *history, const char *oper
     parse_expressionable_token(history);
 }
 
-static int parser_get_precedence_for_operator(const char *op, struct expressionable_operator_precedence_group **group_ptr)
+static bool parser_left_operator_has_higher_priority(int op_left, int op_right)
 {
-    *group_ptr = NULL;
-    for (int i = 0; i < TOTAL_OPERATOR_GROUPS; i++)
-    {
-        for (int j = 0; operator_group[i].operators[j]; j++)
-        {
-            const char *_op = operator_group[i].operators[j];
-            if (S_EQ(op, _op))
-            {
-                *group_ptr = &operator_group[i];
-                return i;
-            }
-        }
-    }
-
-    return -1;
-}
-
-static bool parser_left_operator_has_higher_priority(const char *op_left, const char *op_right)
-{
-    struct expressionable_operator_precedence_group *group_left = NULL;
-    struct expressionable_operator_precedence_group *group_right = NULL;
-    int precedence_left = parser_get_precedence_for_operator(op_left, &group_left);
-    int precedence_right = parser_get_precedence_for_operator(op_right, &group_right);
-
-    if (group_left->associtivity == ASSOCIATIVITY_RIGHT_TO_LEFT)
+    int precedence_left = operator_precedence[op_left];
+    int precedence_right = operator_precedence[op_right];
+    if (precedence_left < 0 || operator_group[precedence_left].associtivity == ASSOCIATIVITY_RIGHT_TO_LEFT)
         return false;
 
     return precedence_left <= precedence_right;
@@ -123,15 +176,18 @@ void parser_node_shift_children_left(struct node *node)
     struct node *new_exp_node_left = node->expression.left;
     struct node *new_exp_node_right = node->expression.right->expression.left;
     const char *new_exp_op = node->expression.operator;
+    int new_exp_op_id = node->expression.op;
     const char *node_exp_op = node->expression.right->expression.operator;
+    int node_exp_op_id = node->expression.right->expression.op;
     struct node *node_exp_right = node->expression.right->expression.right;
 
-    node_make_expression(new_exp_node_left, new_exp_node_right, new_exp_op);
+    node_make_expression(new_exp_node_left, new_exp_node_right, new_exp_op, new_exp_op_id);
     struct node *node_exp_left = node_pop();
 
     node->expression.left = node_exp_left;
     node->expression.right = node_exp_right;
     node->expression.operator = node_exp_op;
+    node->expression.op = node_exp_op_id;
 }
 
 void parser_reorder_expression(struct node **node_ptr)
@@ -144,8 +200,8 @@ void parser_reorder_expression(struct node **node_ptr)
 
     if (node->expression.left->type != NODE_TYPE_EXPRESSION && node->expression.right && node->expression.right->type == NODE_TYPE_EXPRESSION)
     {
-        const char *op_right = node->expression.right->expression.operator;
-        if (parser_left_operator_has_higher_priority(node->expression.operator, op_right))
+        int op_right = node->expression.right->expression.op;
+        if (parser_left_operator_has_higher_priority(node->expression.op, op_right))
         {
             parser_node_shift_children_left(node);
             parser_reorder_expression(&node->expression.left);
@@ -158,6 +214,7 @@ void parse_expression_normal(struct history *history)
 {
     struct token *token = token_peek_next();
     const char *operator = token->sval;
+    int op = token->op;
     struct node *node_left = node_peek_expressionable_or_null();
 
     if (!node_left)
@@ -173,7 +230,7 @@ void parse_expression_normal(struct history *history)
     struct node *node_right = node_pop();
     node_right->flag |= NODE_FLAG_INSIDE_EXPRESSION;
 
-    node_make_expression(node_left, node_right, operator);
+    node_make_expression(node_left, node_right, operator, op);
     struct node *node_expression = node_pop();
     parser_reorder_expression(&node_expression);
     node_push(node_expression);
@@ -253,7 +310,7 @@ int parse(struct compile_process *process)
     parser_last_token = NULL;
     node_set_vector(current_process->node_vec, current_process->node_tree_vec);
     struct node *node = NULL;
-    vector_set_peek_pointer(process->token_vec, 0);
+    parser_index = 0;
 
     while (parse_next() == 0)
     {
@@ -0,0 +1,2043 @@
+#include <stdlib.h>
+#include <limits.h>
+#include "compiler.h"
+#include "helpers/vector.h"
+#include "helpers/buffer.h"
+#include "helpers/intern.h"
+#include "helpers/arena.h"
+#include "helpers/scan.h"
+
+// Deeper #include nesting than this is taken to be an include cycle
+#define PREPROCESSOR_MAX_INCLUDE_DEPTH 200
+#define PREPROCESSOR_MACROS_INITIAL_CAPACITY 64
+// Output handed on through a token ring is dropped once this many of its tokens pile up
+#define PREPROCESSOR_RING_WINDOW 4096
+
+extern struct lex_process_functions compiler_lex_functions;
+extern struct expressionable_operator_precedence_group operator_group[TOTAL_OPERATOR_GROUPS];
+extern int operator_precedence[TOTAL_OPERATORS];
+
+enum
+{
+    PREPROCESSOR_DIRECTIVE_NONE,
+    PREPROCESSOR_DIRECTIVE_INCLUDE,
+    PREPROCESSOR_DIRECTIVE_DEFINE,
+    PREPROCESSOR_DIRECTIVE_UNDEF,
+    PREPROCESSOR_DIRECTIVE_IFDEF,
+    PREPROCESSOR_DIRECTIVE_IFNDEF,
+    PREPROCESSOR_DIRECTIVE_IF,
+    PREPROCESSOR_DIRECTIVE_ELIF,
+    PREPROCESSOR_DIRECTIVE_ELSE,
+    PREPROCESSOR_DIRECTIVE_ENDIF,
+    PREPROCESSOR_DIRECTIVE_PRAGMA,
+    TOTAL_PREPROCESSOR_DIRECTIVES
+};
+
+static const char *preprocessor_directive_names[TOTAL_PREPROCESSOR_DIRECTIVES] = {
+    [PREPROCESSOR_DIRECTIVE_INCLUDE] = "include",
+    [PREPROCESSOR_DIRECTIVE_DEFINE] = "define",
+    [PREPROCESSOR_DIRECTIVE_UNDEF] = "undef",
+    [PREPROCESSOR_DIRECTIVE_IFDEF] = "ifdef",
+    [PREPROCESSOR_DIRECTIVE_IFNDEF] = "ifndef",
+    [PREPROCESSOR_DIRECTIVE_IF] = "if",
+    [PREPROCESSOR_DIRECTIVE_ELIF] = "elif",
+    [PREPROCESSOR_DIRECTIVE_ELSE] = "else",
+    [PREPROCESSOR_DIRECTIVE_ENDIF] = "endif",
+    [PREPROCESSOR_DIRECTIVE_PRAGMA] = "pragma"};
+
+// How far a header is into looking like #ifndef X ... #endif with nothing around it
+enum
+{
+    PREPROCESSOR_GUARD_NOT_SEEN,
+    PREPROCESSOR_GUARD_OPEN,
+    PREPROCESSOR_GUARD_CLOSED,
+    PREPROCESSOR_GUARD_NONE
+};
+
+struct preprocessor_macro
+{
+    // Interned, macros are found by pointer
+    const char *name;
+    // #undef leaves the entry in place
+    bool defined;
+    bool function_like;
+    // The last parameter is __VA_ARGS__
+    bool variadic;
+    // The replacement has # or ## in it, so it is built token by token when expanded
+    bool has_operators;
+    // Set while the macro's expansion is being read, a macro doesn't expand inside itself
+    bool expanding;
+
+    // Interned parameter names
+    const char **params;
+    // Whether each parameter is used other than next to # or ##, the arguments of only
+    // those are expanded
+    bool *expanded_params;
+    int total_params;
+    // The replacement tokens, in the preprocessor's definitions store
+    int body_start;
+    int body_end;
+};
+
+// What is known about a header once it has been included
+struct preprocessor_header
+{
+    // Canonical path, interned
+    const char *path;
+    // Macro of the #ifndef wrapping the whole header, it isn't opened again while the
+    // macro is defined
+    const char *guard;
+    // The header has #pragma once
+    bool once;
+};
+
+struct preprocessor_conditional
+{
+    // The branch being read is kept
+    bool active;
+    // A branch was kept already, the ones after it aren't
+    bool taken;
+    bool seen_else;
+    // Offset of the # of the directive that opened it
+    size_t offset;
+};
+
+// A file being preprocessed. Its tokens are lexed into its lex process's store and
+// handed on to the output a run at a time, directives and inactive regions are left out
+struct preprocessor_file
+{
+    struct lex_process *process;
+    struct compile_process_input_file *input;
+    // NULL for the main input
+    struct preprocessor_header *header;
+    // The store had every token of the file before it was read, from the token cache.
+    // Otherwise tokens are lexed as they're read
+    bool cached;
+    // First token of the store that hasn't been read yet
+    int next;
+    // First token of the store that hasn't been handed on or left out yet
+    int flushed;
+    // struct preprocessor_conditional of the conditionals open in this file
+    struct vector *conditionals;
+
+    int guard_state;
+    const char *guard;
+    // Amount of open conditionals counting the guard's #ifndef
+    int guard_depth;
+};
+
+// Tokens still to be read from a store, expansions are read through a stack of these.
+// A macro's replacement is read right out of the definitions store and its arguments out
+// of the arguments store, neither is copied to be rescanned
+struct preprocessor_context
+{
+    struct token_store *store;
+    int index;
+    int end;
+    // Added to the offsets of the tokens read, for tokens of the file being preprocessed
+    size_t offset_delta;
+    // The macro this is the end of the expansion of, it may expand again once this is read
+    struct preprocessor_macro *macro;
+};
+
+struct preprocessor
+{
+    struct compile_process *compiler;
+    struct token_store *output;
+    const char *directives[TOTAL_PREPROCESSOR_DIRECTIVES];
+    const char *va_args;
+    const char *defined;
+    // The group of ?:, the binary operators of #if are the groups between the postfix
+    // ones and it
+    int conditional_group;
+
+    // Replacement tokens of every macro defined
+    struct token_store *definitions;
+    // Arguments of the calls being expanded and tokens made by # and ##. Emptied once the
+    // expansion of a run of the file is done
+    struct token_store *arguments;
+    // struct preprocessor_context of the expansion being read, the last one is read first
+    struct vector *contexts;
+    // struct preprocessor_context of a replacement being put together
+    struct vector *pending;
+    // struct token_store * arguments are expanded into, one for each call nested in an
+    // argument being expanded
+    struct vector *expansions;
+    int expansion_level;
+    struct buffer *spelling;
+
+    // Open addressing over the interned macro names
+    struct preprocessor_macro *macros;
+    size_t macros_capacity;
+    size_t total_macros;
+
+    // struct preprocessor_header * of every header included so far
+    struct vector *headers;
+    int include_depth;
+
+    // Set when the output is handed on as it's made, each run is pushed into it once its
+    // macros are expanded. Tokens of the output up to published are in the ring
+    struct token_ring *ring;
+    int published;
+};
+
+// A directive's tokens after the #
+struct preprocessor_line
+{
+    struct preprocessor_file *file;
+    int index;
+    int end;
+};
+
+// The tokens of an #if or #elif with its macros expanded, in the arguments store
+struct preprocessor_expression
+{
+    struct preprocessor *preprocessor;
+    int index;
+    int end;
+    // Offset of the directive's #
+    size_t offset;
+};
+
+// #if arithmetic is done in the widest integer type, unsigned once either operand is
+struct preprocessor_value
+{
+    long long value;
+    bool is_unsigned;
+};
+
+// offset is into the file, preprocessor_error_at takes an offset of the compile process
+#define preprocessor_error(preprocessor, file, offset, ...) \
+    preprocessor_error_at(preprocessor, (file)->input->base + (offset), __VA_ARGS__)
+
+#define preprocessor_error_at(preprocessor, offset, ...)           \
+    do                                                             \
+    {                                                              \
+        compiler_set_diagnostic_offset(offset);                    \
+        compiler_error((preprocessor)->compiler, __VA_ARGS__);     \
+    } while (0)
+
+static void preprocessor_run_file(struct preprocessor *preprocessor, struct preprocessor_file *file);
+
+// Pushes the output made since the last run into the ring. The output's tokens are final
+// once they're made, so the ones in the ring are dropped once enough of them pile up
+static void preprocessor_publish(struct preprocessor *preprocessor)
+{
+    struct token_store *output = preprocessor->output;
+    struct token token;
+    for (; preprocessor->published < output->count; preprocessor->published++)
+    {
+        token_store_read(output, preprocessor->published, &token);
+        token_ring_push(preprocessor->ring, &token);
+    }
+
+    if (preprocessor->published >= PREPROCESSOR_RING_WINDOW)
+    {
+        token_store_discard(output, preprocessor->published);
+        preprocessor->published = 0;
+    }
+}
+
+static size_t preprocessor_hash_pointer(const void *ptr)
+{
+    uint64_t hash = (uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return hash ^ hash >> 32;
+}
+
+static void preprocessor_grow_macros(struct preprocessor *preprocessor)
+{
+    struct preprocessor_macro *old_macros = preprocessor->macros;
+    size_t old_capacity = preprocessor->macros_capacity;
+    preprocessor->macros_capacity = old_capacity ? old_capacity * 2 : PREPROCESSOR_MACROS_INITIAL_CAPACITY;
+    preprocessor->macros = calloc(preprocessor->macros_capacity, sizeof(struct preprocessor_macro));
+
+    size_t mask = preprocessor->macros_capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_macros[i].name)
+        {
+            continue;
+        }
+
+        size_t index = preprocessor_hash_pointer(old_macros[i].name) & mask;
+        while (preprocessor->macros[index].name)
+        {
+            index = (index + 1) & mask;
+        }
+        preprocessor->macros[index] = old_macros[i];
+    }
+    free(old_macros);
+}
+
+// Finds the macro entry of an interned name, adding an undefined one when create is set
+static struct preprocessor_macro *preprocessor_macro(struct preprocessor *preprocessor, const char *name, bool create)
+{
+    if (create && (preprocessor->total_macros + 1) * 2 > preprocessor->macros_capacity)
+    {
+        preprocessor_grow_macros(preprocessor);
+    }
+
+    size_t mask = preprocessor->macros_capacity - 1;
+    for (size_t index = preprocessor_hash_pointer(name) & mask;; index = (index + 1) & mask)
+    {
+        struct preprocessor_macro *macro = &preprocessor->macros[index];
+        if (macro->name == name)
+        {
+            return macro;
+        }
+
+        if (!macro->name)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
+
+            macro->name = name;
+            preprocessor->total_macros++;
+            return macro;
+        }
+    }
+}
+
+static bool preprocessor_is_defined(struct preprocessor *preprocessor, const char *name)
+{
+    struct preprocessor_macro *macro = preprocessor_macro(preprocessor, name, false);
+    return macro && macro->defined;
+}
+
+static bool preprocessor_active(struct preprocessor_file *file)
+{
+    struct preprocessor_conditional *conditional = vector_back_or_null(file->conditionals);
+    return !conditional || conditional->active;
+}
+
+static void preprocessor_push_context(struct preprocessor *preprocessor, struct token_store *store, int start, int end, size_t offset_delta, struct preprocessor_macro *macro)
+{
+    struct preprocessor_context context = {.store = store, .index = start, .end = end, .offset_delta = offset_delta, .macro = macro};
+    vector_push(preprocessor->contexts, &context);
+    if (macro)
+    {
+        macro->expanding = true;
+    }
+}
+
+static void preprocessor_pop_context(struct preprocessor *preprocessor)
+{
+    struct preprocessor_context *context = vector_back(preprocessor->contexts);
+    if (context->macro)
+    {
+        context->macro->expanding = false;
+    }
+    vector_pop(preprocessor->contexts);
+}
+
+// The macro a token of a store names, when it is one that expands
+static struct preprocessor_macro *preprocessor_token_macro(struct preprocessor *preprocessor, struct token_store *store, int index)
+{
+    const char *name = NULL;
+    switch (store->kinds[index] & TOKEN_STORE_KIND_MASK)
+    {
+    case TOKEN_TYPE_IDENTIFIER:
+        name = (const char *)(uintptr_t)store->values[store->payloads[index]];
+        break;
+
+    case TOKEN_TYPE_KEYWORD:
+        name = preprocessor->compiler->keywords[store->payloads[index]];
+        break;
+
+    default:
+        return NULL;
+    }
+
+    struct preprocessor_macro *macro = preprocessor_macro(preprocessor, name, false);
+    return macro && macro->defined && !macro->expanding ? macro : NULL;
+}
+
+// Index of the first token of the context that names a macro to expand, its end when none do
+static int preprocessor_find_macro(struct preprocessor *preprocessor, struct preprocessor_context *context, struct preprocessor_macro **macro_ptr)
+{
+    *macro_ptr = NULL;
+    if (!preprocessor->total_macros)
+    {
+        return context->end;
+    }
+
+    for (int index = context->index; index < context->end; index++)
+    {
+        *macro_ptr = preprocessor_token_macro(preprocessor, context->store, index);
+        if (*macro_ptr)
+        {
+            return index;
+        }
+    }
+
+    return context->end;
+}
+
+static bool preprocessor_is_blank(struct token_store *store, int index)
+{
+    int kind = store->kinds[index] & TOKEN_STORE_KIND_MASK;
+    return kind == TOKEN_TYPE_NEWLINE || kind == TOKEN_TYPE_COMMENT;
+}
+
+// Tells if the next token of the contexts above depth, past newlines and comments, is a (
+static bool preprocessor_next_is_call(struct preprocessor *preprocessor, int depth)
+{
+    for (int i = vector_count(preprocessor->contexts) - 1; i >= depth; i--)
+    {
+        struct preprocessor_context *context = vector_at(preprocessor->contexts, i);
+        for (int index = context->index; index < context->end; index++)
+        {
+            if (!preprocessor_is_blank(context->store, index))
+            {
+                return (context->store->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_OPERATOR &&
+                       context->store->payloads[index] == OPERATOR_LEFT_PARENTHESIS;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Takes the next token of the contexts above depth, dropping the ones that run out
+static bool preprocessor_pull(struct preprocessor *preprocessor, int depth, struct token *token)
+{
+    while (vector_count(preprocessor->contexts) > depth)
+    {
+        struct preprocessor_context *context = vector_back(preprocessor->contexts);
+        if (context->index < context->end)
+        {
+            token_store_read(context->store, context->index++, token);
+            token->offset += context->offset_delta;
+            if (token->between_brackets.length)
+            {
+                token->between_brackets.offset += context->offset_delta;
+            }
+            return true;
+        }
+        preprocessor_pop_context(preprocessor);
+    }
+
+    return false;
+}
+
+// Reads the arguments of a call into the arguments store, argument i is from starts[i] up
+// to starts[i + 1]. The ( is the next token
+static void preprocessor_read_arguments(struct preprocessor *preprocessor, struct preprocessor_macro *macro, int depth, int *starts, size_t offset)
+{
+    struct token_store *arguments = preprocessor->arguments;
+    int allowed = macro->total_params ? macro->total_params : 1;
+    int total = 0;
+    int parens = 0;
+    struct token token;
+    // Up to and including the (
+    while (preprocessor_pull(preprocessor, depth, &token) && !(token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_LEFT_PARENTHESIS))
+    {
+    }
+
+    starts[0] = arguments->count;
+    while (true)
+    {
+        if (!preprocessor_pull(preprocessor, depth, &token))
+        {
+            preprocessor_error_at(preprocessor, offset, "Unterminated call of the macro %s", macro->name);
+        }
+
+        if (token_is_comment_newline_or_newline_seperator(&token))
+        {
+            continue;
+        }
+
+        if (token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_LEFT_PARENTHESIS)
+        {
+            parens++;
+        }
+        else if (token_is_symbol(&token, ')') && parens-- == 0)
+        {
+            break;
+        }
+        else if (parens == 0 && token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_COMMA &&
+                 !(macro->variadic && total == macro->total_params - 1))
+        {
+            if (++total == allowed)
+            {
+                preprocessor_error_at(preprocessor, offset, "Too many arguments in the call of the macro %s", macro->name);
+            }
+            starts[total] = arguments->count;
+            continue;
+        }
+
+        token_store_push(arguments, &token);
+    }
+
+    starts[++total] = arguments->count;
+    if (macro->variadic && total == macro->total_params - 1)
+    {
+        // Nothing was passed for the ...
+        starts[++total] = arguments->count;
+    }
+
+    bool no_arguments = macro->total_params == 0 && total == 1 && starts[0] == starts[1];
+    if (total != macro->total_params && !no_arguments)
+    {
+        preprocessor_error_at(preprocessor, offset, "The macro %s takes %i arguments", macro->name, macro->total_params);
+    }
+}
+
+// Index of the parameter a replacement token names, -1 when it isn't one
+static int preprocessor_param(struct preprocessor_macro *macro, struct token_store *store, int index)
+{
+    if ((store->kinds[index] & TOKEN_STORE_KIND_MASK) != TOKEN_TYPE_IDENTIFIER)
+    {
+        return -1;
+    }
+
+    const char *name = (const char *)(uintptr_t)store->values[store->payloads[index]];
+    for (int param = 0; param < macro->total_params; param++)
+    {
+        if (macro->params[param] == name)
+        {
+            return param;
+        }
+    }
+
+    return -1;
+}
+
+static void preprocessor_expand(struct preprocessor *preprocessor, struct token_store *out, int depth);
+
+// Macros in an argument are expanded before it is put in the replacement. The result is
+// the range of the arguments store given back, the argument itself when nothing expands.
+// Calls in the argument read their own arguments into the arguments store, so the result
+// is gathered aside and added after them
+static void preprocessor_expand_argument(struct preprocessor *preprocessor, int *start, int *end)
+{
+    struct preprocessor_context argument = {.store = preprocessor->arguments, .index = *start, .end = *end};
+    struct preprocessor_macro *macro = NULL;
+    if (preprocessor_find_macro(preprocessor, &argument, &macro) == *end)
+    {
+        return;
+    }
+
+    if (vector_count(preprocessor->expansions) == preprocessor->expansion_level)
+    {
+        struct token_store *store = token_store_create(preprocessor->compiler);
+        vector_push(preprocessor->expansions, &store);
+    }
+
+    struct token_store *expansion = vector_peek_ptr_at(preprocessor->expansions, preprocessor->expansion_level++);
+    token_store_clear(expansion);
+    int depth = vector_count(preprocessor->contexts);
+    preprocessor_push_context(preprocessor, preprocessor->arguments, *start, *end, 0, NULL);
+    preprocessor_expand(preprocessor, expansion, depth);
+    preprocessor->expansion_level--;
+
+    *start = preprocessor->arguments->count;
+    token_store_append(preprocessor->arguments, expansion, 0, expansion->count, 0);
+    *end = preprocessor->arguments->count;
+}
+
+// Writes a token as it is spelled, numbers are taken from the source
+static void preprocessor_spell(struct preprocessor *preprocessor, struct token *token, struct buffer *buffer)
+{
+    switch (token->type)
+    {
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_KEYWORD:
+    case TOKEN_TYPE_OPERATOR:
+        buffer_write_bytes(buffer, token->sval, strlen(token->sval));
+        break;
+
+    case TOKEN_TYPE_SYMBOL:
+        buffer_write(buffer, token->cval);
+        break;
+
+    case TOKEN_TYPE_STRING:
+        // Strings made by # have no text of their own in the source
+        if (compile_process_text(preprocessor->compiler, token->offset)[0] != '#')
+        {
+            buffer_write_bytes(buffer, compile_process_text(preprocessor->compiler, token->offset), token->length);
+            break;
+        }
+        buffer_write(buffer, '"');
+        buffer_write_bytes(buffer, token->sval, strlen(token->sval));
+        buffer_write(buffer, '"');
+        break;
+
+    default:
+        buffer_write_bytes(buffer, compile_process_text(preprocessor->compiler, token->offset), token->length);
+    }
+}
+
+// #param, the argument's tokens spelled as a string. Quotes and backslashes in it are
+// escaped so the string reads back as the argument
+static void preprocessor_stringify(struct preprocessor *preprocessor, int start, int end, size_t offset)
+{
+    struct buffer *buffer = preprocessor->spelling;
+    buffer_clear(buffer);
+    struct token token;
+    for (int index = start; index < end; index++)
+    {
+        token_store_read(preprocessor->arguments, index, &token);
+        size_t from = buffer->len;
+        preprocessor_spell(preprocessor, &token, buffer);
+        if (token.type == TOKEN_TYPE_STRING || (token.type == TOKEN_TYPE_NUMBER && compile_process_text(preprocessor->compiler, token.offset)[0] == '\''))
+        {
+            for (size_t i = from; i < buffer->len; i++)
+            {
+                char c = ((char *)buffer_ptr(buffer))[i];
+                if (c == '"' || c == '\\')
+                {
+                    buffer_write(buffer, 0);
+                    memmove((char *)buffer_ptr(buffer) + i + 1, (char *)buffer_ptr(buffer) + i, buffer->len - i - 1);
+                    ((char *)buffer_ptr(buffer))[i++] = '\\';
+                }
+            }
+        }
+
+        if (token.whitespace && index + 1 < end)
+        {
+            buffer_write(buffer, ' ');
+        }
+    }
+
+    const char *text = arena_strndup(preprocessor->compiler->lexemes, buffer_ptr(buffer), buffer->len);
+    token_store_push(preprocessor->arguments, &(struct token){.type = TOKEN_TYPE_STRING, .offset = offset, .sval = text});
+}
+
+// left ## right, the two spellings joined have to lex as a single token
+static void preprocessor_paste(struct preprocessor *preprocessor, struct token *left, struct token *right)
+{
+    struct buffer *buffer = preprocessor->spelling;
+    buffer_clear(buffer);
+    preprocessor_spell(preprocessor, left, buffer);
+    preprocessor_spell(preprocessor, right, buffer);
+
+    struct compile_process_input_file input = {.data = buffer_ptr(buffer), .size = buffer->len};
+    struct lex_process *process = lex_process_create(preprocessor->compiler, &compiler_lex_functions, &input);
+    lex(process);
+    if (process->tokens->count != 1)
+    {
+        preprocessor_error_at(preprocessor, left->offset, "Pasting %.*s does not give a valid token", (int)buffer->len, (char *)buffer_ptr(buffer));
+    }
+
+    struct token token;
+    token_store_read(process->tokens, 0, &token);
+    token.offset = left->offset;
+    token.length = left->length;
+    token.whitespace = right->whitespace;
+    token_store_push(preprocessor->arguments, &token);
+    lex_process_free(process);
+}
+
+static bool preprocessor_is_paste(struct token_store *store, int index, int end)
+{
+    return index + 1 < end && (store->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && store->payloads[index] == '#' &&
+           !(store->kinds[index] & TOKEN_STORE_WHITESPACE) && (store->kinds[index + 1] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && store->payloads[index + 1] == '#';
+}
+
+// Builds a replacement with # or ## in it at the end of the arguments store, token by
+// token. expanded holds the range of every argument once expanded
+static void preprocessor_build_replacement(struct preprocessor *preprocessor, struct preprocessor_macro *macro, int *starts, int *expanded)
+{
+    struct token_store *body = preprocessor->definitions;
+    struct token_store *arguments = preprocessor->arguments;
+    // Whether the last thing put in was an empty argument, pasting onto it leaves the right
+    // side as it is
+    bool last_empty = false;
+    for (int index = macro->body_start; index < macro->body_end; index++)
+    {
+        if (preprocessor_is_paste(body, index, macro->body_end))
+        {
+            index += 2;
+            if (index == macro->body_end)
+            {
+                break;
+            }
+
+            int param = preprocessor_param(macro, body, index);
+            struct token_store *right_store = param < 0 ? body : arguments;
+            int right_start = param < 0 ? index : starts[param];
+            int right_end = param < 0 ? index + 1 : starts[param + 1];
+            if (right_start == right_end)
+            {
+                continue;
+            }
+
+            if (last_empty)
+            {
+                token_store_append(arguments, right_store, right_start, right_end, 0);
+                last_empty = false;
+                continue;
+            }
+
+            struct token left;
+            struct token right;
+            token_store_read(arguments, arguments->count - 1, &left);
+            token_store_read(right_store, right_start, &right);
+            token_store_pop(arguments);
+            preprocessor_paste(preprocessor, &left, &right);
+            token_store_append(arguments, right_store, right_start + 1, right_end, 0);
+            continue;
+        }
+
+        int param = preprocessor_param(macro, body, index);
+        if (macro->function_like && (body->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && body->payloads[index] == '#' &&
+            index + 1 < macro->body_end && (param = preprocessor_param(macro, body, index + 1)) >= 0)
+        {
+            preprocessor_stringify(preprocessor, starts[param], starts[param + 1], body->offsets[index]);
+            last_empty = false;
+            index++;
+            continue;
+        }
+
+        if (param < 0)
+        {
+            token_store_append(arguments, body, index, index + 1, 0);
+            last_empty = false;
+            continue;
+        }
+
+        // Arguments next to ## are put in as they were written
+        bool pasted = preprocessor_is_paste(body, index + 1, macro->body_end);
+        int start = pasted ? starts[param] : expanded[param * 2];
+        int end = pasted ? starts[param + 1] : expanded[param * 2 + 1];
+        token_store_append(arguments, arguments, start, end, 0);
+        last_empty = start == end;
+    }
+}
+
+static void preprocessor_add_pending(struct preprocessor *preprocessor, struct token_store *store, int start, int end)
+{
+    if (start < end)
+    {
+        struct preprocessor_context context = {.store = store, .index = start, .end = end};
+        vector_push(preprocessor->pending, &context);
+    }
+}
+
+// Expands a call of a function like macro whose arguments have been read. The replacement
+// is read as runs of the definition with the expanded arguments between them
+static void preprocessor_expand_call(struct preprocessor *preprocessor, struct preprocessor_macro *macro, int *starts)
+{
+    // Arguments are all expanded first, nothing else goes in the arguments store while the
+    // replacement is put together
+    int expanded[macro->total_params * 2 + 1];
+    for (int param = 0; param < macro->total_params; param++)
+    {
+        expanded[param * 2] = starts[param];
+        expanded[param * 2 + 1] = starts[param + 1];
+        if (macro->expanded_params[param])
+        {
+            preprocessor_expand_argument(preprocessor, &expanded[param * 2], &expanded[param * 2 + 1]);
+        }
+    }
+
+    struct token_store *body = preprocessor->definitions;
+    int pending = vector_count(preprocessor->pending);
+    if (macro->has_operators)
+    {
+        int start = preprocessor->arguments->count;
+        preprocessor_build_replacement(preprocessor, macro, starts, expanded);
+        preprocessor_add_pending(preprocessor, preprocessor->arguments, start, preprocessor->arguments->count);
+    }
+    else
+    {
+        int run = macro->body_start;
+        for (int index = macro->body_start; index < macro->body_end; index++)
+        {
+            int param = preprocessor_param(macro, body, index);
+            if (param < 0)
+            {
+                continue;
+            }
+
+            preprocessor_add_pending(preprocessor, body, run, index);
+            preprocessor_add_pending(preprocessor, preprocessor->arguments, expanded[param * 2], expanded[param * 2 + 1]);
+            run = index + 1;
+        }
+        preprocessor_add_pending(preprocessor, body, run, macro->body_end);
+    }
+
+    // The macro expands again once the last of its replacement has been read
+    preprocessor_push_context(preprocessor, body, macro->body_end, macro->body_end, 0, macro);
+    while (vector_count(preprocessor->pending) > pending)
+    {
+        struct preprocessor_context *context = vector_back(preprocessor->pending);
+        preprocessor_push_context(preprocessor, context->store, context->index, context->end, 0, NULL);
+        vector_pop(preprocessor->pending);
+    }
+}
+
+// Expands the macro named by the next token of the top context
+static void preprocessor_expand_macro(struct preprocessor *preprocessor, struct preprocessor_macro *macro, struct token_store *out, int depth)
+{
+    struct preprocessor_context *context = vector_back(preprocessor->contexts);
+    int index = context->index++;
+    if (!macro->function_like && !macro->has_operators)
+    {
+        preprocessor_push_context(preprocessor, preprocessor->definitions, macro->body_start, macro->body_end, 0, macro);
+        return;
+    }
+
+    if (!macro->function_like)
+    {
+        preprocessor_expand_call(preprocessor, macro, NULL);
+        return;
+    }
+
+    // A function like macro's name without a call after it is left as it is
+    if (!preprocessor_next_is_call(preprocessor, depth))
+    {
+        token_store_append(out, context->store, index, index + 1, context->offset_delta);
+        return;
+    }
+
+    size_t offset = context->store->offsets[index] + context->offset_delta;
+    int starts[macro->total_params + 2];
+    preprocessor_read_arguments(preprocessor, macro, depth, starts, offset);
+    preprocessor_expand_call(preprocessor, macro, starts);
+}
+
+// Hands the tokens of the contexts above depth to out, expanding the macros in them. Runs
+// without a macro in them are handed over whole
+static void preprocessor_expand(struct preprocessor *preprocessor, struct token_store *out, int depth)
+{
+    while (vector_count(preprocessor->contexts) > depth)
+    {
+        struct preprocessor_context *context = vector_back(preprocessor->contexts);
+        struct preprocessor_macro *macro = NULL;
+        int index = preprocessor_find_macro(preprocessor, context, &macro);
+        if (index > context->index)
+        {
+            token_store_append(out, context->store, context->index, index, context->offset_delta);
+            context->index = index;
+        }
+
+        if (!macro)
+        {
+            preprocessor_pop_context(preprocessor);
+            continue;
+        }
+
+        preprocessor_expand_macro(preprocessor, macro, out, depth);
+    }
+}
+
+// Hands the file's tokens up to end to the output with their macros expanded. Inactive
+// regions are skipped before they're lexed, so every token of the store is kept
+static void preprocessor_flush(struct preprocessor *preprocessor, struct preprocessor_file *file, int end)
+{
+    if (end > file->flushed)
+    {
+        preprocessor_push_context(preprocessor, file->process->tokens, file->flushed, end, file->input->base, NULL);
+        preprocessor_expand(preprocessor, preprocessor->output, 0);
+        token_store_clear(preprocessor->arguments);
+        if (preprocessor->ring)
+        {
+            preprocessor_publish(preprocessor);
+        }
+    }
+    file->flushed = end;
+}
+
+// Index of the file's next token in its store, lexed now unless the file is cached. -1
+// once the file ends
+static int preprocessor_next_token(struct preprocessor_file *file)
+{
+    struct token_store *tokens = file->process->tokens;
+    if (file->cached)
+    {
+        return file->next < tokens->count ? file->next++ : -1;
+    }
+
+    struct token *token = lex_next_token(file->process);
+    if (!token)
+    {
+        return -1;
+    }
+
+    file->next = token_store_push(tokens, token) + 1;
+    return file->next - 1;
+}
+
+// Reads the rest of a directive's line, lines ending in a backslash go on to the next.
+// Returns the index of the newline that ends it
+static int preprocessor_read_line(struct preprocessor_file *file)
+{
+    struct token_store *tokens = file->process->tokens;
+    int index = 0;
+    while ((index = preprocessor_next_token(file)) >= 0)
+    {
+        if ((tokens->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_NEWLINE &&
+            (index == 0 || (tokens->kinds[index - 1] & TOKEN_STORE_KIND_MASK) != TOKEN_TYPE_SYMBOL || tokens->payloads[index - 1] != '\\'))
+        {
+            return index;
+        }
+    }
+
+    return file->next;
+}
+
+// Reads the directive's next token, skipping comments and line continuations
+static bool preprocessor_line_next(struct preprocessor_line *line, struct token *token)
+{
+    struct token_store *tokens = line->file->process->tokens;
+    while (line->index < line->end)
+    {
+        token_store_read(tokens, line->index++, token);
+        if (!token_is_comment_newline_or_newline_seperator(token))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Directive names and macro names may be keywords as well as identifiers
+static bool preprocessor_is_name(struct token *token)
+{
+    return token->type == TOKEN_TYPE_IDENTIFIER || token->type == TOKEN_TYPE_KEYWORD;
+}
+
+static int preprocessor_directive_id(struct preprocessor *preprocessor, struct token *token)
+{
+    if (!preprocessor_is_name(token))
+    {
+        return PREPROCESSOR_DIRECTIVE_NONE;
+    }
+
+    for (int directive = PREPROCESSOR_DIRECTIVE_NONE + 1; directive < TOTAL_PREPROCESSOR_DIRECTIVES; directive++)
+    {
+        if (token->sval == preprocessor->directives[directive])
+        {
+            return directive;
+        }
+    }
+
+    return PREPROCESSOR_DIRECTIVE_NONE;
+}
+
+static const char *preprocessor_macro_name(struct preprocessor *preprocessor, struct preprocessor_line *line, size_t offset)
+{
+    struct token name;
+    if (!preprocessor_line_next(line, &name) || !preprocessor_is_name(&name))
+    {
+        preprocessor_error(preprocessor, line->file, offset, "Expected a macro name");
+    }
+
+    return name.sval;
+}
+
+// The canonical path of an included header, interned so that every way of naming a
+// header finds the same record. The search itself is cached by header_search_find
+static const char *preprocessor_find_header(struct preprocessor *preprocessor, struct preprocessor_file *file, const char *name, bool system)
+{
+    const char *path = header_search_find(name, system ? NULL : file->input->abs_path, preprocessor->compiler->include_dirs);
+    return path ? intern(preprocessor->compiler->interned, path, strlen(path)) : NULL;
+}
+
+static struct preprocessor_header *preprocessor_header(struct preprocessor *preprocessor, const char *path)
+{
+    vector_set_peek_pointer(preprocessor->headers, 0);
+    struct preprocessor_header *header = vector_peek_ptr(preprocessor->headers);
+    while (header)
+    {
+        if (header->path == path)
+        {
+            return header;
+        }
+        header = vector_peek_ptr(preprocessor->headers);
+    }
+
+    header = calloc(1, sizeof(struct preprocessor_header));
+    header->path = path;
+    vector_push(preprocessor->headers, &header);
+    return header;
+}
+
+// The name an #include's macros expand to, when its tokens aren't a name to begin with.
+// They expand to a string, or to tokens between < and > that are spelled with the blanks
+// between them like gcc does. name_offset is an offset of the compile process
+static const char *preprocessor_include_expanded(struct preprocessor *preprocessor, struct preprocessor_line *line, size_t offset, bool *system, size_t *name_offset)
+{
+    struct preprocessor_file *file = line->file;
+    struct token_store *arguments = preprocessor->arguments;
+    int start = arguments->count;
+    struct token token;
+    while (preprocessor_line_next(line, &token))
+    {
+        token_store_append(arguments, file->process->tokens, line->index - 1, line->index, file->input->base);
+    }
+
+    int end = arguments->count;
+    preprocessor_expand_argument(preprocessor, &start, &end);
+    const char *name = NULL;
+    if (start < end)
+    {
+        token_store_read(arguments, start, &token);
+        *name_offset = token.offset;
+    }
+
+    if (start + 1 == end && token.type == TOKEN_TYPE_STRING)
+    {
+        name = token.sval;
+        *system = false;
+    }
+    else if (start + 1 < end && token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_LESS)
+    {
+        struct buffer *buffer = preprocessor->spelling;
+        buffer_clear(buffer);
+        int index = start + 1;
+        for (; index < end; index++)
+        {
+            token_store_read(arguments, index, &token);
+            if (token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_GREATER)
+            {
+                break;
+            }
+
+            preprocessor_spell(preprocessor, &token, buffer);
+            if (token.whitespace && index + 1 < end)
+            {
+                buffer_write(buffer, ' ');
+            }
+        }
+
+        if (index + 1 == end)
+        {
+            name = arena_strndup(preprocessor->compiler->lexemes, buffer_ptr(buffer), buffer->len);
+            *system = true;
+        }
+    }
+
+    if (!name)
+    {
+        preprocessor_error(preprocessor, file, offset, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    token_store_clear(arguments);
+    return name;
+}
+
+static void preprocessor_include(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line, size_t offset)
+{
+    struct token token;
+    int first = line->index;
+    if (!preprocessor_line_next(line, &token))
+    {
+        preprocessor_error(preprocessor, file, offset, "#include expects \"FILENAME\" or <FILENAME>");
+    }
+
+    const char *name = token.sval;
+    bool system = file->input->data[token.offset] == '<';
+    size_t name_offset = file->input->base + token.offset;
+    if (token.type != TOKEN_TYPE_STRING)
+    {
+        // #include MACRO, the name is what the line's macros expand to
+        line->index = first;
+        name = preprocessor_include_expanded(preprocessor, line, offset, &system, &name_offset);
+    }
+
+    const char *path = preprocessor_find_header(preprocessor, file, name, system);
+    if (!path)
+    {
+        preprocessor_error_at(preprocessor, name_offset, "Unable to find the included file %s", name);
+    }
+
+    // Headers that can't change the output again aren't even opened
+    struct preprocessor_header *header = preprocessor_header(preprocessor, path);
+    if (header->once || (header->guard && preprocessor_is_defined(preprocessor, header->guard)))
+    {
+        return;
+    }
+
+    if (preprocessor->include_depth >= PREPROCESSOR_MAX_INCLUDE_DEPTH)
+    {
+        preprocessor_error(preprocessor, file, offset, "#include nested too deeply");
+    }
+
+    struct compile_process_input_file *input = compile_process_include_file(preprocessor->compiler, path);
+    if (!input)
+    {
+        preprocessor_error_at(preprocessor, name_offset, "Unable to read the included file %s", path);
+    }
+
+    struct lex_process *process = lex_process_create(preprocessor->compiler, &compiler_lex_functions, input);
+    process->base = input->base;
+    struct preprocessor_file included = {
+        .process = process,
+        .input = input,
+        .header = header,
+        .conditionals = vector_create(sizeof(struct preprocessor_conditional))};
+    int cache_flags = COMPILE_PROCESS_FLAG_TOKEN_CACHE | COMPILE_PROCESS_FLAG_SHARED_HEADERS;
+    included.cached = (preprocessor->compiler->flags & cache_flags) && token_cache_fill(included.process);
+
+    preprocessor->include_depth++;
+    preprocessor_run_file(preprocessor, &included);
+    preprocessor->include_depth--;
+
+    lex_process_free(included.process);
+    vector_free(included.conditionals);
+}
+
+static void preprocessor_open_conditional(struct preprocessor_file *file, bool condition, size_t offset)
+{
+    // Conditionals inside inactive regions are skipped with them, this one is in an active one
+    struct preprocessor_conditional conditional = {.active = condition, .taken = condition, .offset = offset};
+    vector_push(file->conditionals, &conditional);
+}
+
+static struct preprocessor_conditional *preprocessor_conditional(struct preprocessor *preprocessor, struct preprocessor_file *file, size_t offset, const char *directive)
+{
+    struct preprocessor_conditional *conditional = vector_back_or_null(file->conditionals);
+    if (!conditional)
+    {
+        preprocessor_error(preprocessor, file, offset, "#%s without #if", directive);
+    }
+
+    return conditional;
+}
+
+// A guard's #ifndef with another branch doesn't wrap the header as a whole
+static void preprocessor_guard_branch(struct preprocessor_file *file)
+{
+    if (file->guard_state == PREPROCESSOR_GUARD_OPEN && vector_count(file->conditionals) == file->guard_depth)
+    {
+        file->guard_state = PREPROCESSOR_GUARD_NONE;
+    }
+}
+
+static void preprocessor_else(struct preprocessor *preprocessor, struct preprocessor_file *file, size_t offset)
+{
+    struct preprocessor_conditional *conditional = preprocessor_conditional(preprocessor, file, offset, "else");
+    if (conditional->seen_else)
+    {
+        preprocessor_error(preprocessor, file, offset, "#else after #else");
+    }
+
+    conditional->seen_else = true;
+    conditional->active = !conditional->taken;
+    conditional->taken = true;
+    preprocessor_guard_branch(file);
+}
+
+static void preprocessor_endif(struct preprocessor *preprocessor, struct preprocessor_file *file, size_t offset)
+{
+    preprocessor_conditional(preprocessor, file, offset, "endif");
+    vector_pop(file->conditionals);
+    if (file->guard_state == PREPROCESSOR_GUARD_OPEN && vector_count(file->conditionals) < file->guard_depth)
+    {
+        file->guard_state = PREPROCESSOR_GUARD_CLOSED;
+    }
+}
+
+static void preprocessor_ifdef(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line, size_t offset, bool defined)
+{
+    const char *name = preprocessor_macro_name(preprocessor, line, offset);
+    preprocessor_open_conditional(file, preprocessor_is_defined(preprocessor, name) == defined, offset);
+    if (!defined && file->guard_state == PREPROCESSOR_GUARD_NOT_SEEN)
+    {
+        file->guard_state = PREPROCESSOR_GUARD_OPEN;
+        file->guard = name;
+        file->guard_depth = vector_count(file->conditionals);
+    }
+}
+
+// Reads the expression's next token without taking it, skipping comments and line
+// continuations
+static bool preprocessor_expression_peek(struct preprocessor_expression *expression, struct token *token)
+{
+    struct token_store *tokens = expression->preprocessor->arguments;
+    for (; expression->index < expression->end; expression->index++)
+    {
+        token_store_read(tokens, expression->index, token);
+        if (!token_is_comment_newline_or_newline_seperator(token))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool preprocessor_expression_next(struct preprocessor_expression *expression, struct token *token)
+{
+    if (!preprocessor_expression_peek(expression, token))
+    {
+        return false;
+    }
+
+    expression->index++;
+    return true;
+}
+
+// Index of the operator_group a binary operator of #if is in, -1 for anything else
+static int preprocessor_binary_group(struct preprocessor *preprocessor, struct token *token)
+{
+    if (token->type != TOKEN_TYPE_OPERATOR)
+    {
+        return -1;
+    }
+
+    int group = operator_precedence[token->op];
+    return group >= 1 && group <= preprocessor->conditional_group ? group : -1;
+}
+
+static struct preprocessor_value preprocessor_evaluate_binary(struct preprocessor_expression *expression, int max_group, bool evaluated);
+
+static struct preprocessor_value preprocessor_evaluate_unary(struct preprocessor_expression *expression, bool evaluated)
+{
+    struct preprocessor *preprocessor = expression->preprocessor;
+    struct token token;
+    if (!preprocessor_expression_next(expression, &token))
+    {
+        preprocessor_error_at(preprocessor, expression->offset, "Expected a value in #if");
+    }
+
+    struct preprocessor_value value = {0};
+    switch (token.type)
+    {
+    case TOKEN_TYPE_NUMBER:
+        if (token.flags & NUMBER_FLAG_FLOATING)
+        {
+            preprocessor_error_at(preprocessor, token.offset, "Floating constant in #if");
+        }
+        value.value = token.llnum;
+        value.is_unsigned = (token.flags & NUMBER_FLAG_UNSIGNED) || token.llnum > LLONG_MAX;
+        return value;
+
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_KEYWORD:
+        // Names that are left once macros are expanded are 0
+        return value;
+
+    case TOKEN_TYPE_OPERATOR:
+        switch (token.op)
+        {
+        case OPERATOR_LEFT_PARENTHESIS:
+            value = preprocessor_evaluate_binary(expression, preprocessor->conditional_group, evaluated);
+            if (!preprocessor_expression_next(expression, &token) || !token_is_symbol(&token, ')'))
+            {
+                preprocessor_error_at(preprocessor, expression->offset, "Missing ) in #if");
+            }
+            return value;
+
+        case OPERATOR_PLUS:
+            return preprocessor_evaluate_unary(expression, evaluated);
+
+        case OPERATOR_MINUS:
+            value = preprocessor_evaluate_unary(expression, evaluated);
+            value.value = -(unsigned long long)value.value;
+            return value;
+
+        case OPERATOR_BITWISE_NOT:
+            value = preprocessor_evaluate_unary(expression, evaluated);
+            value.value = ~value.value;
+            return value;
+
+        case OPERATOR_LOGICAL_NOT:
+            value = preprocessor_evaluate_unary(expression, evaluated);
+            return (struct preprocessor_value){.value = !value.value};
+        }
+    }
+
+    preprocessor_error_at(preprocessor, token.offset, "Unexpected token in #if");
+    return value;
+}
+
+static struct preprocessor_value preprocessor_apply(struct preprocessor_expression *expression, struct token *op, struct preprocessor_value left, struct preprocessor_value right, bool evaluated)
+{
+    bool is_unsigned = left.is_unsigned || right.is_unsigned;
+    unsigned long long a = left.value;
+    unsigned long long b = right.value;
+    long long result = 0;
+    switch (op->op)
+    {
+    case OPERATOR_MULTIPLY:
+        result = a * b;
+        break;
+
+    case OPERATOR_DIVIDE:
+    case OPERATOR_MODULO:
+        if (!b)
+        {
+            if (evaluated)
+            {
+                preprocessor_error_at(expression->preprocessor, op->offset, "Division by zero in #if");
+            }
+            break;
+        }
+
+        if (is_unsigned)
+        {
+            result = op->op == OPERATOR_DIVIDE ? a / b : a % b;
+        }
+        else if (left.value == LLONG_MIN && right.value == -1)
+        {
+            // Overflows, wraps around like the other operators do
+            result = op->op == OPERATOR_DIVIDE ? LLONG_MIN : 0;
+        }
+        else
+        {
+            result = op->op == OPERATOR_DIVIDE ? left.value / right.value : left.value % right.value;
+        }
+        break;
+
+    case OPERATOR_PLUS:
+        result = a + b;
+        break;
+
+    case OPERATOR_MINUS:
+        result = a - b;
+        break;
+
+    case OPERATOR_LEFT_SHIFT:
+    case OPERATOR_RIGHT_SHIFT:
+    {
+        // The result takes the type of the left operand alone
+        is_unsigned = left.is_unsigned;
+        bool left_shift = op->op == OPERATOR_LEFT_SHIFT;
+        long long amount = right.value;
+        if (!right.is_unsigned && amount < 0)
+        {
+            left_shift = !left_shift;
+            amount = -(unsigned long long)amount;
+        }
+
+        if (left_shift)
+        {
+            result = (unsigned long long)amount < 64 ? a << amount : 0;
+        }
+        else if (is_unsigned)
+        {
+            result = (unsigned long long)amount < 64 ? a >> amount : 0;
+        }
+        else
+        {
+            result = left.value >> ((unsigned long long)amount < 64 ? amount : 63);
+        }
+        break;
+    }
+
+    case OPERATOR_LESS:
+        return (struct preprocessor_value){.value = is_unsigned ? a < b : left.value < right.value};
+
+    case OPERATOR_LESS_EQUAL:
+        return (struct preprocessor_value){.value = is_unsigned ? a <= b : left.value <= right.value};
+
+    case OPERATOR_GREATER:
+        return (struct preprocessor_value){.value = is_unsigned ? a > b : left.value > right.value};
+
+    case OPERATOR_GREATER_EQUAL:
+        return (struct preprocessor_value){.value = is_unsigned ? a >= b : left.value >= right.value};
+
+    case OPERATOR_EQUAL:
+        return (struct preprocessor_value){.value = a == b};
+
+    case OPERATOR_NOT_EQUAL:
+        return (struct preprocessor_value){.value = a != b};
+
+    case OPERATOR_BITWISE_AND:
+        result = a & b;
+        break;
+
+    case OPERATOR_BITWISE_XOR:
+        result = a ^ b;
+        break;
+
+    case OPERATOR_BITWISE_OR:
+        result = a | b;
+        break;
+
+    case OPERATOR_LOGICAL_AND:
+        return (struct preprocessor_value){.value = a && b};
+
+    case OPERATOR_LOGICAL_OR:
+        return (struct preprocessor_value){.value = a || b};
+    }
+
+    return (struct preprocessor_value){.value = result, .is_unsigned = is_unsigned};
+}
+
+// Evaluates operators of the groups up to max_group by precedence climbing over
+// operator_group. Operands that aren't evaluated, like the right side of 0 &&, are still
+// read but can't fail
+static struct preprocessor_value preprocessor_evaluate_binary(struct preprocessor_expression *expression, int max_group, bool evaluated)
+{
+    struct preprocessor *preprocessor = expression->preprocessor;
+    struct preprocessor_value value = preprocessor_evaluate_unary(expression, evaluated);
+    struct token op;
+    while (preprocessor_expression_peek(expression, &op))
+    {
+        int group = preprocessor_binary_group(preprocessor, &op);
+        if (group < 0 || group > max_group)
+        {
+            break;
+        }
+
+        expression->index++;
+        // Operators of the same group are taken on the right as well when they group that way
+        int right_group = operator_group[group].associtivity == ASSOCIATIVITY_RIGHT_TO_LEFT ? group : group - 1;
+        if (group == preprocessor->conditional_group)
+        {
+            bool condition = value.value != 0;
+            struct preprocessor_value then = preprocessor_evaluate_binary(expression, preprocessor->conditional_group, evaluated && condition);
+            struct token colon;
+            if (!preprocessor_expression_next(expression, &colon) || !token_is_symbol(&colon, ':'))
+            {
+                preprocessor_error_at(preprocessor, op.offset, "Expected : in #if");
+            }
+
+            struct preprocessor_value otherwise = preprocessor_evaluate_binary(expression, right_group, evaluated && !condition);
+            value = condition ? then : otherwise;
+            value.is_unsigned = then.is_unsigned || otherwise.is_unsigned;
+            continue;
+        }
+
+        bool short_circuit = (op.op == OPERATOR_LOGICAL_AND && !value.value) || (op.op == OPERATOR_LOGICAL_OR && value.value);
+        struct preprocessor_value right = preprocessor_evaluate_binary(expression, right_group, evaluated && !short_circuit);
+        value = preprocessor_apply(expression, &op, value, right, evaluated);
+    }
+
+    return value;
+}
+
+// defined NAME and defined(NAME), replaced with 1 or 0 before macros are expanded
+static bool preprocessor_defined(struct preprocessor *preprocessor, struct preprocessor_line *line, size_t offset)
+{
+    struct token token;
+    int index = line->index;
+    bool parenthesized = preprocessor_line_next(line, &token) && token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_LEFT_PARENTHESIS;
+    if (!parenthesized)
+    {
+        line->index = index;
+    }
+
+    const char *name = preprocessor_macro_name(preprocessor, line, offset);
+    if (parenthesized && (!preprocessor_line_next(line, &token) || !token_is_symbol(&token, ')')))
+    {
+        preprocessor_error(preprocessor, line->file, offset, "Missing ) after defined");
+    }
+
+    return preprocessor_is_defined(preprocessor, name);
+}
+
+// Evaluates the expression of an #if or #elif. Its tokens go to the arguments store with
+// defined worked out, then macros are expanded in them like in an argument
+static bool preprocessor_evaluate(struct preprocessor *preprocessor, struct preprocessor_line *line, size_t offset)
+{
+    struct preprocessor_file *file = line->file;
+    struct token_store *arguments = preprocessor->arguments;
+    int start = arguments->count;
+    struct token token;
+    while (preprocessor_line_next(line, &token))
+    {
+        if (token.type == TOKEN_TYPE_IDENTIFIER && token.sval == preprocessor->defined)
+        {
+            bool defined = preprocessor_defined(preprocessor, line, token.offset);
+            token_store_push(arguments, &(struct token){.type = TOKEN_TYPE_NUMBER, .offset = file->input->base + token.offset, .length = token.length, .llnum = defined});
+            continue;
+        }
+
+        token_store_append(arguments, file->process->tokens, line->index - 1, line->index, file->input->base);
+    }
+
+    int end = arguments->count;
+    if (start == end)
+    {
+        preprocessor_error(preprocessor, file, offset, "#if with no expression");
+    }
+
+    preprocessor_expand_argument(preprocessor, &start, &end);
+    struct preprocessor_expression expression = {.preprocessor = preprocessor, .index = start, .end = end, .offset = file->input->base + offset};
+    struct preprocessor_value value = preprocessor_evaluate_binary(&expression, preprocessor->conditional_group, true);
+    if (preprocessor_expression_peek(&expression, &token))
+    {
+        preprocessor_error_at(preprocessor, token.offset, "Unexpected token in #if");
+    }
+
+    token_store_clear(arguments);
+    return value.value != 0;
+}
+
+static void preprocessor_if(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line, size_t offset)
+{
+    preprocessor_open_conditional(file, preprocessor_evaluate(preprocessor, line, offset), offset);
+}
+
+static void preprocessor_elif(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line, size_t offset)
+{
+    struct preprocessor_conditional *conditional = preprocessor_conditional(preprocessor, file, offset, "elif");
+    if (conditional->seen_else)
+    {
+        preprocessor_error(preprocessor, file, offset, "#elif after #else");
+    }
+
+    // Once a branch has been kept the expressions of the ones after it aren't evaluated
+    conditional->active = !conditional->taken && preprocessor_evaluate(preprocessor, line, offset);
+    conditional->taken |= conditional->active;
+    preprocessor_guard_branch(file);
+}
+
+static void preprocessor_pragma(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line)
+{
+    struct token name;
+    if (file->header && preprocessor_line_next(line, &name) && name.type == TOKEN_TYPE_IDENTIFIER && S_EQ(name.sval, "once"))
+    {
+        file->header->once = true;
+    }
+}
+
+static bool preprocessor_line_at(struct preprocessor_line *line, int type, int payload)
+{
+    struct token_store *tokens = line->file->process->tokens;
+    return line->index < line->end && (tokens->kinds[line->index] & TOKEN_STORE_KIND_MASK) == type && tokens->payloads[line->index] == payload;
+}
+
+static void preprocessor_define_params(struct preprocessor *preprocessor, struct preprocessor_macro *macro, struct preprocessor_line *line, size_t offset)
+{
+    struct vector *params = vector_create(sizeof(const char *));
+    struct token token;
+    // The (
+    preprocessor_line_next(line, &token);
+    while (preprocessor_line_next(line, &token) && !(vector_empty(params) && token_is_symbol(&token, ')')))
+    {
+        const char *param = token.sval;
+        if (token.type == TOKEN_TYPE_OPERATOR && token.op == OPERATOR_ELLIPSIS)
+        {
+            macro->variadic = true;
+            param = preprocessor->va_args;
+        }
+        else if (!preprocessor_is_name(&token))
+        {
+            preprocessor_error(preprocessor, line->file, token.offset, "Expected a parameter name");
+        }
+        vector_push(params, &param);
+
+        if (!preprocessor_line_next(line, &token) || (token_is_symbol(&token, ')')))
+        {
+            break;
+        }
+
+        if (macro->variadic || token.type != TOKEN_TYPE_OPERATOR || token.op != OPERATOR_COMMA)
+        {
+            preprocessor_error(preprocessor, line->file, token.offset, "Expected , or ) in the parameters of the macro %s", macro->name);
+        }
+    }
+
+    if (!token_is_symbol(&token, ')'))
+    {
+        preprocessor_error(preprocessor, line->file, offset, "Unterminated parameters of the macro %s", macro->name);
+    }
+
+    macro->total_params = vector_count(params);
+    macro->params = malloc(macro->total_params * sizeof(const char *) + 1);
+    memcpy(macro->params, vector_data_ptr(params), macro->total_params * sizeof(const char *));
+    vector_free(params);
+}
+
+static void preprocessor_define(struct preprocessor *preprocessor, struct preprocessor_file *file, struct preprocessor_line *line, size_t offset)
+{
+    struct token_store *tokens = file->process->tokens;
+    const char *name = preprocessor_macro_name(preprocessor, line, offset);
+    struct preprocessor_macro *macro = preprocessor_macro(preprocessor, name, true);
+    free(macro->params);
+    free(macro->expanded_params);
+    *macro = (struct preprocessor_macro){.name = name, .defined = true};
+
+    // A ( right after the name, with no blank between, starts the parameters
+    if (!(tokens->kinds[line->index - 1] & TOKEN_STORE_WHITESPACE) && preprocessor_line_at(line, TOKEN_TYPE_OPERATOR, OPERATOR_LEFT_PARENTHESIS))
+    {
+        macro->function_like = true;
+        preprocessor_define_params(preprocessor, macro, line, offset);
+    }
+
+    macro->body_start = preprocessor->definitions->count;
+    for (int index = line->index; index < line->end; index++)
+    {
+        if (preprocessor_is_blank(tokens, index) || ((tokens->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && tokens->payloads[index] == '\\'))
+        {
+            continue;
+        }
+
+        macro->has_operators |= (tokens->kinds[index] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && tokens->payloads[index] == '#';
+        token_store_append(preprocessor->definitions, tokens, index, index + 1, file->input->base);
+    }
+    macro->body_end = preprocessor->definitions->count;
+
+    struct token_store *body = preprocessor->definitions;
+    macro->expanded_params = calloc(macro->total_params + 1, sizeof(bool));
+    for (int index = macro->body_start; index < macro->body_end; index++)
+    {
+        int param = preprocessor_param(macro, body, index);
+        bool after_operator = index > macro->body_start && (body->kinds[index - 1] & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL && body->payloads[index - 1] == '#';
+        if (param >= 0 && !after_operator && !preprocessor_is_paste(body, index + 1, macro->body_end))
+        {
+            macro->expanded_params[param] = true;
+        }
+    }
+}
+
+static void preprocessor_directive(struct preprocessor *preprocessor, struct preprocessor_file *file, int hash_index)
+{
+    struct preprocessor_line line = {.file = file, .index = hash_index + 1, .end = preprocessor_read_line(file)};
+    size_t offset = file->process->tokens->offsets[hash_index];
+    struct token name;
+    if (!preprocessor_line_next(&line, &name))
+    {
+        // A # on its own does nothing
+        return;
+    }
+
+    int directive = preprocessor_directive_id(preprocessor, &name);
+    if ((file->guard_state == PREPROCESSOR_GUARD_NOT_SEEN && directive != PREPROCESSOR_DIRECTIVE_IFNDEF) ||
+        file->guard_state == PREPROCESSOR_GUARD_CLOSED)
+    {
+        file->guard_state = PREPROCESSOR_GUARD_NONE;
+    }
+
+    // Inactive regions are skipped up to the directives that may end them, whatever is
+    // read here is in an active region or ends one
+    switch (directive)
+    {
+    case PREPROCESSOR_DIRECTIVE_IFDEF:
+    case PREPROCESSOR_DIRECTIVE_IFNDEF:
+        preprocessor_ifdef(preprocessor, file, &line, offset, directive == PREPROCESSOR_DIRECTIVE_IFDEF);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_IF:
+        preprocessor_if(preprocessor, file, &line, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_ELIF:
+        preprocessor_elif(preprocessor, file, &line, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_ELSE:
+        preprocessor_else(preprocessor, file, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_ENDIF:
+        preprocessor_endif(preprocessor, file, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_INCLUDE:
+        preprocessor_include(preprocessor, file, &line, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_DEFINE:
+        preprocessor_define(preprocessor, file, &line, offset);
+        break;
+
+    case PREPROCESSOR_DIRECTIVE_UNDEF:
+    {
+        const char *macro_name = preprocessor_macro_name(preprocessor, &line, offset);
+        preprocessor_macro(preprocessor, macro_name, true)->defined = false;
+        break;
+    }
+
+    case PREPROCESSOR_DIRECTIVE_PRAGMA:
+        preprocessor_pragma(preprocessor, file, &line);
+        break;
+
+    default:
+        preprocessor_error(preprocessor, file, name.offset, "Unknown preprocessor directive");
+    }
+}
+
+// The conditional directive a line of an inactive region has, ptr is right after its #
+static int preprocessor_skipped_directive(const char *ptr, const char *end)
+{
+    ptr += scan.skip_blanks(ptr, end - ptr);
+    size_t length = 0;
+    while (ptr + length < end && ptr[length] >= 'a' && ptr[length] <= 'z')
+    {
+        length++;
+    }
+
+    for (int directive = PREPROCESSOR_DIRECTIVE_IFDEF; directive <= PREPROCESSOR_DIRECTIVE_ENDIF; directive++)
+    {
+        const char *directive_name = preprocessor_directive_names[directive];
+        if (strlen(directive_name) == length && !memcmp(ptr, directive_name, length))
+        {
+            return directive;
+        }
+    }
+
+    return PREPROCESSOR_DIRECTIVE_NONE;
+}
+
+// Tells if a quote opened before pos on the line is still open, so that a /* at pos is
+// text of a string
+static bool preprocessor_in_quotes(const char *data, size_t line, size_t pos)
+{
+    char quote = 0;
+    for (size_t i = line; i < pos; i++)
+    {
+        if (data[i] == '\\')
+        {
+            i++;
+        }
+        else if (quote ? data[i] == quote : data[i] == '"' || data[i] == '\'')
+        {
+            quote = quote ? 0 : data[i];
+        }
+    }
+
+    return quote != 0;
+}
+
+// Index of the newline that ends the line starting at line, past comments and lines
+// continued with a backslash. size when the text ends first
+static size_t preprocessor_line_end(const char *data, size_t line, size_t size)
+{
+    size_t pos = line;
+    while (pos < size)
+    {
+        size_t found = pos + scan.find_either(data + pos, size - pos, '\n', '/');
+        if (found == size)
+        {
+            return size;
+        }
+
+        if (data[found] == '/')
+        {
+            char next = found + 1 < size ? data[found + 1] : 0;
+            if ((next != '*' && next != '/') || preprocessor_in_quotes(data, line, found))
+            {
+                pos = found + 1;
+            }
+            else if (next == '/')
+            {
+                const char *newline = memchr(data + found, '\n', size - found);
+                pos = newline ? newline - data : size;
+            }
+            else
+            {
+                const char *close = memchr(data + found + 2, '*', size - found - 2);
+                while (close && (close + 1 == data + size || close[1] != '/'))
+                {
+                    close = memchr(close + 1, '*', data + size - close - 1);
+                }
+                pos = close ? close - data + 2 : size;
+                line = pos;
+            }
+            continue;
+        }
+
+        size_t before = found > line && data[found - 1] == '\r' ? found - 1 : found;
+        if (before > line && data[before - 1] == '\\')
+        {
+            pos = line = found + 1;
+            continue;
+        }
+
+        return found;
+    }
+
+    return size;
+}
+
+// Skips an inactive region in the text itself, no tokens are made for it. Only lines
+// starting with # are looked at, conditionals opened in the region are counted to find
+// the #elif, #else or #endif that may end it. The file is read on from the start of that
+// line, or from its end. A cached file skips its tokens up to there instead
+static void preprocessor_skip(struct preprocessor_file *file)
+{
+    struct token_store *tokens = file->process->tokens;
+    size_t from = file->process->offset;
+    if (file->cached)
+    {
+        from = file->next ? tokens->offsets[file->next - 1] + tokens->lengths[file->next - 1] : 0;
+    }
+
+    const char *data = file->input->data + from;
+    size_t size = file->input->size - from;
+    int depth = 0;
+    size_t line = 0;
+    while (line < size)
+    {
+        size_t start = line + scan.skip_blanks(data + line, size - line);
+        if (start < size && data[start] == '#')
+        {
+            int directive = preprocessor_skipped_directive(data + start + 1, data + size);
+            if (directive == PREPROCESSOR_DIRECTIVE_IF || directive == PREPROCESSOR_DIRECTIVE_IFDEF || directive == PREPROCESSOR_DIRECTIVE_IFNDEF)
+            {
+                depth++;
+            }
+            else if (directive == PREPROCESSOR_DIRECTIVE_ENDIF && depth)
+            {
+                depth--;
+            }
+            else if (depth == 0 && (directive == PREPROCESSOR_DIRECTIVE_ENDIF || directive == PREPROCESSOR_DIRECTIVE_ELSE || directive == PREPROCESSOR_DIRECTIVE_ELIF))
+            {
+                break;
+            }
+        }
+        line = preprocessor_line_end(data, start, size) + 1;
+    }
+
+    size_t amount = line < size ? line : size;
+    if (!file->cached)
+    {
+        lex_skip_input(file->process, amount);
+        return;
+    }
+
+    // The first token past the region, by binary search over the offsets
+    int low = file->next;
+    int high = tokens->count;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (tokens->offsets[middle] < from + amount)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    file->next = low;
+}
+
+static void preprocessor_run_file(struct preprocessor *preprocessor, struct preprocessor_file *file)
+{
+    struct lex_process *process = file->process;
+    struct token_store *tokens = process->tokens;
+    bool line_start = true;
+
+    if (!file->cached)
+    {
+        lex_begin(process);
+    }
+
+    int index = 0;
+    while ((index = preprocessor_next_token(file)) >= 0)
+    {
+        int kind = tokens->kinds[index] & TOKEN_STORE_KIND_MASK;
+        if (line_start && kind == TOKEN_TYPE_SYMBOL && tokens->payloads[index] == '#')
+        {
+            // The directive's line is read up to and including its newline
+            preprocessor_flush(preprocessor, file, index);
+            preprocessor_directive(preprocessor, file, index);
+            if (!preprocessor_active(file))
+            {
+                preprocessor_skip(file);
+            }
+            file->flushed = file->next;
+            continue;
+        }
+
+        if (kind == TOKEN_TYPE_NEWLINE)
+        {
+            line_start = true;
+        }
+        else if (kind != TOKEN_TYPE_COMMENT)
+        {
+            line_start = false;
+            if (file->guard_state != PREPROCESSOR_GUARD_OPEN)
+            {
+                file->guard_state = PREPROCESSOR_GUARD_NONE;
+            }
+        }
+    }
+
+    if (!file->cached)
+    {
+        lex_end(process);
+    }
+    preprocessor_flush(preprocessor, file, file->next);
+
+    struct preprocessor_conditional *conditional = vector_back_or_null(file->conditionals);
+    if (conditional)
+    {
+        preprocessor_error(preprocessor, file, conditional->offset, "Unterminated conditional directive");
+    }
+
+    if (file->header && file->guard_state == PREPROCESSOR_GUARD_CLOSED)
+    {
+        file->header->guard = file->guard;
+    }
+}
+
+// Tells if a file lexed all at once can be preprocessed from its tokens. Its inactive
+// regions are lexed then too, so a string opened in one may run past the #else or #endif
+// that ends it. It can't when a string runs to the end of the file unterminated, or a
+// string or comment runs over a line starting with #
+static bool preprocessor_can_read_ahead(struct token_store *tokens, struct compile_process_input_file *input)
+{
+    const char *data = input->data;
+    for (int i = 0; i < tokens->count; i++)
+    {
+        int kind = tokens->kinds[i] & TOKEN_STORE_KIND_MASK;
+        if (kind != TOKEN_TYPE_STRING && kind != TOKEN_TYPE_COMMENT)
+        {
+            continue;
+        }
+
+        size_t start = tokens->offsets[i];
+        size_t end = start + tokens->lengths[i];
+        char close = data[start] == '<' ? '>' : '"';
+        if (kind == TOKEN_TYPE_STRING && end >= input->size && (end - start < 2 || data[end - 1] != close))
+        {
+            return false;
+        }
+
+        const char *newline = memchr(data + start, '\n', end - start);
+        while (newline)
+        {
+            size_t line = newline + 1 - data;
+            line += scan.skip_blanks(data + line, end - line);
+            if (line < end && data[line] == '#')
+            {
+                return false;
+            }
+            newline = memchr(data + line, '\n', end - line);
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Lexes the whole of a file the preprocessor is to read into the store of its lex process,
+ * on several threads when it's the compile's own input and the compile is set to lex in
+ * parallel. Errors don't end the compile, the file is left for the preprocessor to lex as
+ * it reads it, which skips inactive regions an error could be in. So is a file whose
+ * tokens it can't be read from
+ */
+bool preprocessor_lex_ahead(struct lex_process *process, struct compile_process_input_file *input)
+{
+    struct compile_process *compiler = process->compiler;
+    jmp_buf speculation_failed;
+    process->speculation_failed = &speculation_failed;
+    if (setjmp(speculation_failed) == 0)
+    {
+        if (input == &compiler->cfile && (compiler->flags & COMPILE_PROCESS_FLAG_PARALLEL_LEX))
+        {
+            lex_parallel(process, 0);
+        }
+        else
+        {
+            lex(process);
+        }
+
+        process->speculation_failed = NULL;
+        if (!process->unmatched_close && preprocessor_can_read_ahead(process->tokens, input))
+        {
+            return true;
+        }
+    }
+
+    process->speculation_failed = NULL;
+    process->unmatched_close = false;
+    process->leading_whitespace = false;
+    process->current_expression_count = 0;
+    process->offset = 0;
+    input->index = 0;
+    token_store_clear(process->tokens);
+    return false;
+}
+
+/**
+ * Tells if an input has a line starting with a directive, inputs without one aren't
+ * preprocessed. A # at the start of a line that isn't followed by a name is left to the
+ * parser, as is any other #
+ */
+bool preprocessor_has_directives(struct compile_process_input_file *input)
+{
+    const char *data = input->data;
+    size_t size = input->size;
+    const char *hash = memchr(data, '#', size);
+    while (hash)
+    {
+        size_t line = hash - data;
+        while (line > 0 && (data[line - 1] == ' ' || data[line - 1] == '\t'))
+        {
+            line--;
+        }
+
+        size_t name = hash + 1 - data;
+        name += scan.skip_blanks(data + name, size - name);
+        char c = name < size ? data[name] : 0;
+        if ((line == 0 || data[line - 1] == '\n') && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'))
+        {
+            return true;
+        }
+        hash = memchr(hash + 1, '#', data + size - hash - 1);
+    }
+
+    return false;
+}
+
+/**
+ * Preprocesses the compile's own input into the compile's store, or into ring when it is
+ * set. The tokens are pushed into the ring as they're made then, for a parser on another
+ * thread. With COMPILE_PROCESS_FLAG_PARALLEL_LEX the input is lexed whole on several
+ * threads first, when it can be read from its tokens
+ */
+int preprocess(struct lex_process *process, struct token_ring *ring)
+{
+    struct compile_process *compiler = process->compiler;
+    struct preprocessor preprocessor = {
+        .compiler = compiler,
+        .output = ring ? token_store_create(compiler) : compiler->tokens,
+        .ring = ring,
+        .definitions = token_store_create(compiler),
+        .arguments = token_store_create(compiler),
+        .contexts = vector_create(sizeof(struct preprocessor_context)),
+        .pending = vector_create(sizeof(struct preprocessor_context)),
+        .expansions = vector_create(sizeof(struct token_store *)),
+        .spelling = buffer_create(),
+        .headers = vector_create(sizeof(struct preprocessor_header *))};
+    preprocessor_grow_macros(&preprocessor);
+    preprocessor.va_args = intern(compiler->interned, "__VA_ARGS__", strlen("__VA_ARGS__"));
+    preprocessor.defined = intern(compiler->interned, "defined", strlen("defined"));
+    preprocessor.conditional_group = operator_precedence[OPERATOR_QUESTION];
+    for (int directive = PREPROCESSOR_DIRECTIVE_NONE + 1; directive < TOTAL_PREPROCESSOR_DIRECTIVES; directive++)
+    {
+        const char *name = preprocessor_directive_names[directive];
+        preprocessor.directives[directive] = intern(compiler->interned, name, strlen(name));
+    }
+
+    struct preprocessor_file file = {.process = process, .input = &compiler->cfile, .conditionals = vector_create(sizeof(struct preprocessor_conditional))};
+    file.cached = (compiler->flags & COMPILE_PROCESS_FLAG_PARALLEL_LEX) && preprocessor_lex_ahead(process, &compiler->cfile);
+    preprocessor_run_file(&preprocessor, &file);
+    vector_free(file.conditionals);
+
+    vector_set_peek_pointer(preprocessor.headers, 0);
+    struct preprocessor_header *header = vector_peek_ptr(preprocessor.headers);
+    while (header)
+    {
+        free(header);
+        header = vector_peek_ptr(preprocessor.headers);
+    }
+    vector_free(preprocessor.headers);
+
+    for (size_t i = 0; i < preprocessor.macros_capacity; i++)
+    {
+        free(preprocessor.macros[i].params);
+        free(preprocessor.macros[i].expanded_params);
+    }
+    free(preprocessor.macros);
+    token_store_free(preprocessor.definitions);
+    token_store_free(preprocessor.arguments);
+    vector_free(preprocessor.contexts);
+    vector_free(preprocessor.pending);
+    for (int i = 0; i < vector_count(preprocessor.expansions); i++)
+    {
+        token_store_free(vector_peek_ptr_at(preprocessor.expansions, i));
+    }
+    vector_free(preprocessor.expansions);
+    buffer_free(preprocessor.spelling);
+    if (ring)
+    {
+        token_store_free(preprocessor.output);
+    }
+    return PREPROCESSING_ALL_OK;
+}
@@ -0,0 +1 @@
+#define SCALE 20
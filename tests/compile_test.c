@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "compiler.h"
+
+// Whole compiles run on several threads at once, every file with every flags on every
+// thread. The parser keeps its state per thread, a compile that reads another's ends up
+// popping nodes it never pushed
+struct test_compile
+{
+    const char *filename;
+    int flags;
+};
+
+static const struct test_compile test_compiles[] = {
+    {"./tests/compile/numbers.c", 0},
+    {"./tests/compile/numbers.c", COMPILE_PROCESS_FLAG_STREAM_TOKENS},
+    {"./tests/compile/numbers.c", COMPILE_PROCESS_FLAG_THREADED_LEX},
+    {"./tests/compile/numbers.c", COMPILE_PROCESS_FLAG_PARALLEL_LEX},
+    {"./tests/compile/expressions.c", 0},
+    {"./tests/compile/expressions.c", COMPILE_PROCESS_FLAG_SHARED_HEADERS},
+    {"./tests/compile/expressions.c", COMPILE_PROCESS_FLAG_SHARED_HEADERS | COMPILE_PROCESS_FLAG_THREADED_LEX},
+    {"./tests/compile/expressions.c", COMPILE_PROCESS_FLAG_SHARED_HEADERS | COMPILE_PROCESS_FLAG_TOKEN_CACHE},
+};
+
+#define TEST_TOTAL_COMPILES (sizeof(test_compiles) / sizeof(test_compiles[0]))
+#define TEST_THREADS 8
+#define TEST_THREAD_ROUNDS 16
+
+struct test_thread
+{
+    pthread_t thread;
+    int failed;
+};
+
+static void *test_thread_run(void *arg)
+{
+    struct test_thread *thread = arg;
+    for (int round = 0; round < TEST_THREAD_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < TEST_TOTAL_COMPILES; i++)
+        {
+            thread->failed += compile_file(test_compiles[i].filename, NULL, test_compiles[i].flags) != COMPILER_FILE_COMPILED_OK;
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    token_cache_set_directory("./build/test_token_cache");
+    for (size_t i = 0; i < TEST_TOTAL_COMPILES; i++)
+    {
+        if (compile_file(test_compiles[i].filename, NULL, test_compiles[i].flags) != COMPILER_FILE_COMPILED_OK)
+        {
+            printf("FAIL %s: flags %d don't compile\n", test_compiles[i].filename, test_compiles[i].flags);
+            return 1;
+        }
+    }
+
+    struct test_thread threads[TEST_THREADS] = {0};
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_create(&threads[i].thread, NULL, test_thread_run, &threads[i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        failed += threads[i].failed;
+    }
+
+    if (failed)
+    {
+        printf("FAIL %d compiles on %d threads at once\n", failed, TEST_THREADS);
+        return 1;
+    }
+    printf("ok %d threads compiling\n", TEST_THREADS);
+    return 0;
+}
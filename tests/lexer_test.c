@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include "compiler.h"
+#include "helpers/buffer.h"
+
+extern struct lex_process_functions compiler_lex_functions;
+
+// Writes the whole of the formatted text, fields of a token are short
+static void test_write(struct buffer *buffer, const char *fmt, ...)
+{
+    char text[128];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    buffer_write_bytes(buffer, text, length < (int)sizeof(text) ? length : (int)sizeof(text) - 1);
+}
+
+// The tokens of a store, one line each
+static struct buffer *test_dump(struct token_store *tokens)
+{
+    struct buffer *buffer = buffer_create();
+    struct token token;
+    for (int i = 0; i < tokens->count; i++)
+    {
+        token_store_read(tokens, i, &token);
+        test_write(buffer, "%zu %zu %d %d ", token.offset, token.length, token.type, token.whitespace);
+        switch (token.type)
+        {
+        case TOKEN_TYPE_NUMBER:
+            test_write(buffer, "%llu %d", token.llnum, token.flags);
+            break;
+        case TOKEN_TYPE_SYMBOL:
+            test_write(buffer, "%c", token.cval);
+            break;
+        case TOKEN_TYPE_NEWLINE:
+            break;
+        default:
+            buffer_write_bytes(buffer, token.sval, strlen(token.sval));
+        }
+        test_write(buffer, " %zu %zu\n", token.between_brackets.offset, token.between_brackets.length);
+    }
+    return buffer;
+}
+
+static bool test_same(struct buffer *output, struct buffer *expected)
+{
+    return output->len == expected->len && !memcmp(buffer_ptr(output), buffer_ptr(expected), expected->len);
+}
+
+// The process of a whole input lexed in one go
+static struct lex_process *test_lex(const char *input)
+{
+    struct compile_process *compiler = compile_process_create_from_buffer(input, strlen(input), NULL, 0);
+    struct lex_process *process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+    lex(process);
+    return process;
+}
+
+// An edit replaces the first text after the previous edit
+struct test_edit
+{
+    const char *text;
+    const char *replacement;
+};
+
+#define TEST_MAX_EDITS 4
+
+struct test_incremental
+{
+    const char *name;
+    struct test_edit edits[TEST_MAX_EDITS];
+};
+
+static const char *test_incremental_input =
+    "int main(int argc, char **argv)\n"
+    "{\n"
+    "    int total = (argc + 1) * 2;\n"
+    "    const char *name = \"scratch\";\n"
+    "    // counts down\n"
+    "    while (total > 0)\n"
+    "    {\n"
+    "        total = total - (1);\n"
+    "    }\n"
+    "    /* done */\n"
+    "    return total + 0x10;\n"
+    "}\n";
+
+static const struct test_incremental test_incrementals[] = {
+    {"a token changed", {{"argc + 1", "argc + 12"}}},
+    {"a line added first", {{"int main", "long x;\nint main"}}},
+    {"a line removed", {{"    // counts down\n", ""}}},
+    {"a comment opened and closed lines apart", {{"// counts", "/* counts"}, {"/* done */", "done */"}}},
+    {"a newline inside brackets", {{"(total > 0)", "(total >\n 0)"}}},
+    {"brackets opened across lines", {{"(1);", "(1\n);"}}},
+    {"a line added last", {{"0x10;\n}\n", "0x10;\n}\nint y = 1;\n"}}},
+    {"edits lines apart", {{"argc + 1", "argc - 1"}, {"\"scratch\"", "\"incremental\""}, {"0x10", "16"}}},
+    {"edits on one line", {{"total", "count"}, {"argc", "argv"}, {"2", "3"}}},
+    {"the last newline removed", {{"0x10;\n}\n", "0x10;\n}"}}},
+};
+
+// Lexes the input again after edits, against lexing the edited input whole
+static int test_incremental(const struct test_incremental *test)
+{
+    struct buffer *input = buffer_create();
+    struct lex_edit edits[TEST_MAX_EDITS];
+    int total_edits = 0;
+    const char *rest = test_incremental_input;
+    for (; total_edits < TEST_MAX_EDITS && test->edits[total_edits].text; total_edits++)
+    {
+        const struct test_edit *edit = &test->edits[total_edits];
+        const char *text = strstr(rest, edit->text);
+        buffer_write_bytes(input, (void *)rest, text - rest);
+        buffer_write_bytes(input, (void *)edit->replacement, strlen(edit->replacement));
+        edits[total_edits] = (struct lex_edit){.offset = text - test_incremental_input, .old_length = strlen(edit->text), .new_length = strlen(edit->replacement)};
+        rest = text + strlen(edit->text);
+    }
+    buffer_write_bytes(input, (void *)rest, strlen(rest));
+    buffer_write(input, 0);
+
+    struct buffer *expected = test_dump(test_lex(buffer_ptr(input))->tokens);
+    struct token_store *old_tokens = test_lex(test_incremental_input)->tokens;
+    struct compile_process *compiler = compile_process_create_from_buffer(buffer_ptr(input), strlen(buffer_ptr(input)), NULL, 0);
+    struct lex_process *process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+    lex_incremental(process, old_tokens, edits, total_edits);
+    if (process->tokens != old_tokens || !test_same(test_dump(process->tokens), expected))
+    {
+        printf("FAIL incremental, %s: other tokens than lexing it whole\n", test->name);
+        return 1;
+    }
+    return 0;
+}
+
+// Inputs lexed on this many threads are split into as many chunks of at least 256 KB
+#define TEST_PARALLEL_THREADS 4
+#define TEST_PARALLEL_BLOCK_SIZE (300 * 1024)
+#define TEST_PARALLEL_FILLER_SIZE (4 * 1024)
+
+// A parallel input is a block of code for every thread. Between the blocks, something is
+// opened and closed again a filler later, the input splits into chunks inside the filler
+struct test_parallel
+{
+    const char *name;
+    const char *open;
+    // A line repeated between open and close
+    const char *filler;
+    const char *close;
+};
+
+static const struct test_parallel test_parallels[] = {
+    {"code", "", "", ""},
+    {"comments across chunks", "/* a comment\n", "it's (not code \"nor a string\n", "*/\n"},
+    {"brackets across chunks", "call(\n", "    argc,\n", "    \"argv\")\n;\n"},
+    {"a string closing a comment", "/* \"\n", "\"*/\"\n", "*/\n"},
+};
+
+// Lexes an input of several chunks on several threads, against lexing it serially
+static int test_parallel(const struct test_parallel *test)
+{
+    struct buffer *input = buffer_create();
+    for (int i = 0; i < TEST_PARALLEL_THREADS; i++)
+    {
+        if (i > 0)
+        {
+            size_t filler_end = input->len + TEST_PARALLEL_FILLER_SIZE;
+            buffer_write_bytes(input, test->open, strlen(test->open));
+            while (*test->filler && input->len < filler_end)
+            {
+                buffer_write_bytes(input, test->filler, strlen(test->filler));
+            }
+            buffer_write_bytes(input, test->close, strlen(test->close));
+        }
+
+        size_t block_end = input->len + TEST_PARALLEL_BLOCK_SIZE;
+        while (input->len < block_end)
+        {
+            buffer_write_bytes(input, test_incremental_input, strlen(test_incremental_input));
+        }
+    }
+    buffer_write(input, 0);
+
+    struct buffer *expected = test_dump(test_lex(buffer_ptr(input))->tokens);
+    struct compile_process *compiler = compile_process_create_from_buffer(buffer_ptr(input), strlen(buffer_ptr(input)), NULL, 0);
+    struct lex_process *process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+    lex_parallel(process, TEST_PARALLEL_THREADS);
+    if (!test_same(test_dump(process->tokens), expected))
+    {
+        printf("FAIL parallel, %s: other tokens than lexing it serially\n", test->name);
+        return 1;
+    }
+    return 0;
+}
+
+// A source that hands its input over in chunks of a few characters, like one read from a
+// stream would. Spans end where the chunks do, unless fewer than the characters asked for
+// are left in the chunk, those are put together
+struct test_chunked
+{
+    const char *input;
+    size_t size;
+    size_t index;
+    size_t chunk_size;
+    char joined[LEX_PROCESS_LOOKAHEAD_SIZE];
+};
+
+static struct lex_process_span test_chunked_peek_span(struct lex_process *process, size_t min)
+{
+    struct test_chunked *chunked = lex_process_private(process);
+    size_t chunk_end = (chunked->index / chunked->chunk_size + 1) * chunked->chunk_size;
+    size_t left = chunked->size - chunked->index;
+    size_t len = chunk_end - chunked->index < left ? chunk_end - chunked->index : left;
+    if (len >= min || len == left)
+    {
+        return (struct lex_process_span){.ptr = chunked->input + chunked->index, .len = len};
+    }
+
+    len = min < left ? min : left;
+    memcpy(chunked->joined, chunked->input + chunked->index, len);
+    return (struct lex_process_span){.ptr = chunked->joined, .len = len};
+}
+
+static void test_chunked_skip_span(struct lex_process *process, size_t amount)
+{
+    struct test_chunked *chunked = lex_process_private(process);
+    chunked->index += amount;
+}
+
+static struct lex_process_functions test_chunked_functions = {
+    .peek_span = test_chunked_peek_span,
+    .skip_span = test_chunked_skip_span};
+
+static const char *test_chunked_input =
+    "unsigned long long mask = 0x1fULL << 3, half = .5e-1;\n"
+    "x <<= 2; y >>= 1; z = a->b ? c : d...;\n"
+    "char *path = \"a/b.h\"; /* ** / */ // done\n";
+
+// Lexes inputs in chunks of this many characters and fewer than the lexer asks for at once
+static const size_t test_chunk_sizes[] = {1, 2, 3, 7, 64};
+
+// Lexes an input handed over in chunks, against lexing it in one span
+static int test_chunked(const char *input, size_t chunk_size)
+{
+    struct buffer *expected = test_dump(test_lex(input)->tokens);
+    struct compile_process *compiler = compile_process_create_from_buffer(input, strlen(input), NULL, 0);
+    struct test_chunked chunked = {.input = input, .size = strlen(input), .chunk_size = chunk_size};
+    struct lex_process *process = lex_process_create(compiler, &test_chunked_functions, &chunked);
+    lex(process);
+    if (!test_same(test_dump(process->tokens), expected))
+    {
+        printf("FAIL chunked, %zu characters each: other tokens than lexing it in one span\n", chunk_size);
+        return 1;
+    }
+    return 0;
+}
+
+// An integer constant, its value and flags when message is NULL, the error it gives
+// otherwise
+struct test_number
+{
+    const char *text;
+    unsigned long long value;
+    int flags;
+    const char *message;
+};
+
+static const struct test_number test_numbers[] = {
+    {"18446744073709551615", 18446744073709551615ULL},
+    {"18446744073709551616", .message = "Integer constant is too large"},
+    {"99999999999999999999", .message = "Integer constant is too large"},
+    {"0xffffffffffffffff", 0xffffffffffffffffULL},
+    {"0x10000000000000000", .message = "Integer constant is too large"},
+    {"01777777777777777777777", 01777777777777777777777ULL},
+    {"02000000000000000000000", .message = "Integer constant is too large"},
+    {"0b1111111111111111111111111111111111111111111111111111111111111111", 0xffffffffffffffffULL},
+    {"0b10000000000000000000000000000000000000000000000000000000000000000", .message = "Integer constant is too large"},
+    {"0", 0},
+    {"0755", 0755},
+    {"08", .message = "Invalid digit 8 in octal constant"},
+    {"0x", .message = "Expected a digit after 0x"},
+    {"0b", .message = "Expected a digit after 0b"},
+    {"0xg", .message = "Expected a digit after 0x"},
+    {"0b2", .message = "Invalid digit 2 in a base 2 constant"},
+    {"0b1012", .message = "Invalid digit 2 in a base 2 constant"},
+    {"1u", 1, NUMBER_FLAG_UNSIGNED},
+    {"1U", 1, NUMBER_FLAG_UNSIGNED},
+    {"1l", 1, NUMBER_FLAG_LONG},
+    {"1ll", 1, NUMBER_FLAG_LONG_LONG},
+    {"1LL", 1, NUMBER_FLAG_LONG_LONG},
+    {"1ul", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG},
+    {"1lu", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG},
+    {"1ull", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG_LONG},
+    {"1llu", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG_LONG},
+    {"1uLL", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG_LONG},
+    {"1LLU", 1, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG_LONG},
+    {"0x1fULL", 0x1f, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG_LONG},
+    {"017lu", 017, NUMBER_FLAG_UNSIGNED | NUMBER_FLAG_LONG},
+};
+
+// Lexes text, the first token is put in token. The message of the error lexing it gave,
+// NULL when it gave none
+static const char *test_lex_first(const char *text, struct token *token)
+{
+    struct compile_error error;
+    if (setjmp(error.caught))
+    {
+        compiler_catch_errors(NULL);
+        return error.message;
+    }
+
+    compiler_catch_errors(&error);
+    struct lex_process *process = test_lex(text);
+    compiler_catch_errors(NULL);
+    token_store_read(process->tokens, 0, token);
+    return NULL;
+}
+
+static int test_number(const struct test_number *test)
+{
+    struct token token;
+    const char *message = test_lex_first(test->text, &token);
+    if (test->message)
+    {
+        if (!message || !S_EQ(message, test->message))
+        {
+            printf("FAIL number %s: gave %s instead of \"%s\"\n", test->text, message ? message : "no error", test->message);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (message || token.type != TOKEN_TYPE_NUMBER || token.llnum != test->value || token.flags != test->flags)
+    {
+        printf("FAIL number %s: gave %s\n", test->text, message ? message : "another value");
+        return 1;
+    }
+    return 0;
+}
+
+// A floating constant, with the flags of its suffix. Its value must be what strtod makes
+// of it, whether it's worked out from the digits or converted again from the text
+struct test_floating
+{
+    const char *text;
+    int flags;
+};
+
+static const struct test_floating test_floatings[] = {
+    {"1.5"},
+    {"0.1"},
+    {"3.14159265358979323846"},
+    {"123456789012345678.0"},
+    {"1e10"},
+    {"1e-10"},
+    {"1E+22"},
+    {"1e23"},
+    {"1e400"},
+    {"1e-400"},
+    {".5"},
+    {"5."},
+    {"1.7976931348623157e308"},
+    {"1.7976931348623159e308"},
+    {"2.2250738585072011e-308"},
+    {"2.2250738585072012e-308"},
+    {"4.9406564584124654e-324"},
+    {"2.4703282292062327e-324"},
+    {"2.4703282292062328e-324"},
+    // Halfway between two doubles, and only just either side of it
+    {"9007199254740993.0"},
+    {"9007199254740993.00000000000000000001"},
+    {"9007199254740992.99999999999999999999"},
+    {"9007199254740995.0"},
+    {"0.500000000000000166533453693773481063544750213623046875"},
+    {"0.500000000000000166533453693773481063544750213623046876"},
+    {"123456789012345678901234567890.0"},
+    {"0.000000000000000000000000000000000000000000000000000000000001"},
+    {"0x1p0"},
+    {"0x.8p1"},
+    {"0x1.8p-3"},
+    {"0xAp-2"},
+    {"0x1p-1074"},
+    {"0x1p-1075"},
+    {"0x1.fffffffffffffp1023"},
+    {"0x1p1024"},
+    {"0x1.00000000000008p0"},
+    {"0x1.00000000000018p0"},
+    {"0x1.000000000000080000000001p0"},
+    {"0x1.0000000000000fffffffffffp0"},
+    {"0x0.00000000000000000000000000000001p0"},
+    {"0x1.00000000000008p-1022"},
+    {"0x1.8p-1074"},
+    {"1.5f", NUMBER_FLAG_FLOAT},
+    {"1.5F", NUMBER_FLAG_FLOAT},
+    {"1e10f", NUMBER_FLAG_FLOAT},
+    {"0x1p4f", NUMBER_FLAG_FLOAT},
+    {"1.5l", NUMBER_FLAG_LONG},
+    {"1.5L", NUMBER_FLAG_LONG},
+    {"0x1.8p1L", NUMBER_FLAG_LONG},
+};
+
+static int test_floating(const struct test_floating *test)
+{
+    struct token token;
+    const char *message = test_lex_first(test->text, &token);
+    double expected = strtod(test->text, NULL);
+    if (message || token.type != TOKEN_TYPE_NUMBER || token.flags != (NUMBER_FLAG_FLOATING | test->flags) ||
+        memcmp(&token.dval, &expected, sizeof(double)))
+    {
+        printf("FAIL floating %s: gave %s, not %.17g\n", test->text, message ? message : "another value", expected);
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(test_incrementals) / sizeof(test_incrementals[0]); i++)
+    {
+        failed += test_incremental(&test_incrementals[i]);
+    }
+    if (!failed)
+    {
+        printf("ok incremental lexing\n");
+    }
+
+    int failed_numbers = 0;
+    for (size_t i = 0; i < sizeof(test_numbers) / sizeof(test_numbers[0]); i++)
+    {
+        failed_numbers += test_number(&test_numbers[i]);
+    }
+    if (!failed_numbers)
+    {
+        printf("ok integer constants\n");
+    }
+    failed += failed_numbers;
+
+    int failed_floatings = 0;
+    for (size_t i = 0; i < sizeof(test_floatings) / sizeof(test_floatings[0]); i++)
+    {
+        failed_floatings += test_floating(&test_floatings[i]);
+    }
+    if (!failed_floatings)
+    {
+        printf("ok floating constants\n");
+    }
+    failed += failed_floatings;
+
+    int failed_parallel = 0;
+    for (size_t i = 0; i < sizeof(test_parallels) / sizeof(test_parallels[0]); i++)
+    {
+        failed_parallel += test_parallel(&test_parallels[i]);
+    }
+    if (!failed_parallel)
+    {
+        printf("ok parallel lexing on %d threads\n", TEST_PARALLEL_THREADS);
+    }
+    failed += failed_parallel;
+
+    int failed_chunked = 0;
+    for (size_t i = 0; i < sizeof(test_chunk_sizes) / sizeof(test_chunk_sizes[0]); i++)
+    {
+        failed_chunked += test_chunked(test_incremental_input, test_chunk_sizes[i]);
+        failed_chunked += test_chunked(test_chunked_input, test_chunk_sizes[i]);
+    }
+    if (!failed_chunked)
+    {
+        printf("ok sources read in chunks\n");
+    }
+    failed += failed_chunked;
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,6 @@
+/* Quotes that do close, this header is read from the token cache */
+#ifndef CLOSED_QUOTES_H
+#define CLOSED_QUOTES_H
+#define scaled(x) ((x) * 4)
+const char *greeting = "hello";
+#endif
@@ -0,0 +1,9 @@
+// Includes named by what their macros expand to
+#define QUOTED "include/searched.h"
+#include QUOTED
+#define SYSTEM <searched.h>
+#include SYSTEM
+#define STRINGIFY(x) #x
+#define HEADER(name) STRINGIFY(name.h)
+#include HEADER(searched)
+int computed = SEARCHED;
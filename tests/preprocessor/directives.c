@@ -0,0 +1,16 @@
+#include "closed_quotes.h"
+#define LIMIT 16
+#define pair(a, b) { (a), (b) }
+
+#if LIMIT > 8
+int limits[] = pair(LIMIT,
+    LIMIT * 2);
+#else
+int limits[] = pair(LIMIT, LIMIT / 2);
+#endif
+
+#if 0
+an unmatched " in an inactive region
+#endif
+int wide = scaled(LIMIT);
+const char *name = "closed";
@@ -0,0 +1,2 @@
+// Found before the assert.h of the system, directories added for a compile come first
+int include_dir_assert;
@@ -0,0 +1 @@
+#define SEARCHED 1
@@ -0,0 +1,4 @@
+// Headers found in a directory added for the compile
+#include <assert.h>
+#include "searched.h"
+int searched = SEARCHED;
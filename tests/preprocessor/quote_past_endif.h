@@ -0,0 +1,5 @@
+#if 0
+an unmatched " in an inactive region
+#endif
+int past = 2;
+const char *text = "closed";
@@ -0,0 +1,4 @@
+#include "unterminated_quote.h"
+#include "quote_past_endif.h"
+#include "closed_quotes.h"
+int total = in_else + past + scaled(3);
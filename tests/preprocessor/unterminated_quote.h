@@ -0,0 +1,5 @@
+#ifdef NOT_DEFINED
+an unmatched " runs to the end of the file
+#else
+int in_else = 1;
+#endif
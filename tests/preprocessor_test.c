@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <dirent.h>
+#include "compiler.h"
+#include "helpers/buffer.h"
+
+extern struct lex_process_functions compiler_lex_functions;
+
+// Every file is preprocessed as it's read and then by compiles on several threads sharing
+// headers, with the tokens of its headers taken from the token cache and the header cache,
+// with the input lexed ahead and with the output handed over from a thread. The tokens
+// handed on must be the same
+static const char *test_files[] = {
+    // Quotes left open in inactive regions of headers
+    "./tests/preprocessor/unterminated.c",
+    // Directives in the input itself, with a quote left open in an inactive region
+    "./tests/preprocessor/directives.c",
+    // Headers named by macros
+    "./tests/preprocessor/computed_include.c",
+    // Headers in the directory added for every compile, one named like a system header.
+    // Kept last, see TEST_INCLUDE_DIR_IDENTIFIER
+    "./tests/preprocessor/include_dirs.c",
+};
+
+// Added to the directories every compile looks for headers in
+#define TEST_INCLUDE_DIR "./tests/preprocessor/include"
+// Declared by the header in TEST_INCLUDE_DIR named like the assert.h of the system
+#define TEST_INCLUDE_DIR_IDENTIFIER "include_dir_assert"
+
+static const int test_flags[] = {
+    COMPILE_PROCESS_FLAG_TOKEN_CACHE,
+    // Mapped from the cache the run before wrote, when it wrote one
+    COMPILE_PROCESS_FLAG_TOKEN_CACHE,
+    COMPILE_PROCESS_FLAG_SHARED_HEADERS,
+    COMPILE_PROCESS_FLAG_PARALLEL_LEX,
+    COMPILE_PROCESS_FLAG_THREADED_LEX,
+};
+
+// Written by the compiles with COMPILE_PROCESS_FLAG_TOKEN_CACHE, emptied before every run
+#define TEST_TOKEN_CACHE "./build/test_token_cache"
+// Where the kinds of the tokens start in a file of the token cache, right after its header
+#define TEST_TOKEN_CACHE_KINDS 136
+
+#define TEST_TOTAL_FILES (sizeof(test_files) / sizeof(test_files[0]))
+// Compiles sharing headers preprocess every file on this many threads at once, as many
+// times each
+#define TEST_THREADS 8
+#define TEST_THREAD_ROUNDS 16
+
+// A thread of compiles sharing headers, against the tokens of every file preprocessed alone
+struct test_thread
+{
+    pthread_t thread;
+    struct buffer **expected;
+    int failed;
+};
+
+// Writes the whole of the formatted text, fields of a token are short
+static void test_write(struct buffer *buffer, const char *fmt, ...)
+{
+    char text[128];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    buffer_write_bytes(buffer, text, length < (int)sizeof(text) ? length : (int)sizeof(text) - 1);
+}
+
+// The preprocessed tokens of a file, one line each
+static struct buffer *test_preprocess(const char *filename, int flags)
+{
+    struct compile_process *compiler = compile_process_create(filename, NULL, flags);
+    if (!compiler)
+    {
+        return NULL;
+    }
+
+    compile_process_add_include_dir(compiler, TEST_INCLUDE_DIR);
+    struct lex_process *process = lex_process_create(compiler, &compiler_lex_functions, NULL);
+    compiler->tokens = token_store_create(compiler);
+    if (flags & COMPILE_PROCESS_FLAG_THREADED_LEX)
+    {
+        // Popped the way the parser pops them
+        struct lex_pipeline *pipeline = lex_pipeline_start(process, true);
+        struct token token;
+        while (token_ring_pop(compiler->token_ring, &token))
+        {
+            token_store_push(compiler->tokens, &token);
+        }
+
+        bool failed = compiler->token_ring->error != NULL;
+        lex_pipeline_join(pipeline);
+        if (failed)
+        {
+            return NULL;
+        }
+    }
+    else if (preprocess(process, NULL) != PREPROCESSING_ALL_OK)
+    {
+        return NULL;
+    }
+
+    struct buffer *buffer = buffer_create();
+    struct token token;
+    for (int i = 0; i < compiler->tokens->count; i++)
+    {
+        token_store_read(compiler->tokens, i, &token);
+        test_write(buffer, "%zu %d %d ", token.offset, token.type, token.whitespace);
+        switch (token.type)
+        {
+        case TOKEN_TYPE_NUMBER:
+            test_write(buffer, "%llu %d", token.llnum, token.flags);
+            break;
+        case TOKEN_TYPE_SYMBOL:
+            test_write(buffer, "%c", token.cval);
+            break;
+        case TOKEN_TYPE_NEWLINE:
+            break;
+        default:
+            buffer_write_bytes(buffer, token.sval, strlen(token.sval));
+        }
+        test_write(buffer, " %zu %zu\n", token.between_brackets.offset, token.between_brackets.length);
+    }
+    return buffer;
+}
+
+static bool test_same(struct buffer *output, struct buffer *expected)
+{
+    return output && output->len == expected->len && !memcmp(buffer_ptr(output), buffer_ptr(expected), expected->len);
+}
+
+static void *test_thread_run(void *arg)
+{
+    struct test_thread *thread = arg;
+    for (int round = 0; round < TEST_THREAD_ROUNDS; round++)
+    {
+        for (size_t i = 0; i < TEST_TOTAL_FILES; i++)
+        {
+            thread->failed += !test_same(test_preprocess(test_files[i], COMPILE_PROCESS_FLAG_SHARED_HEADERS), thread->expected[i]);
+        }
+    }
+    return NULL;
+}
+
+// Preprocesses every file on several threads at once, the compiles share the headers the
+// threads include at the same time
+static int test_threads(struct buffer **expected)
+{
+    struct test_thread threads[TEST_THREADS] = {0};
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        threads[i].expected = expected;
+        pthread_create(&threads[i].thread, NULL, test_thread_run, &threads[i]);
+    }
+
+    int failed = 0;
+    for (int i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(threads[i].thread, NULL);
+        failed += threads[i].failed;
+    }
+
+    if (failed)
+    {
+        printf("FAIL %d compiles on %d threads sharing headers give other tokens\n", failed, TEST_THREADS);
+        return 1;
+    }
+    printf("ok %d threads sharing headers\n", TEST_THREADS);
+    return 0;
+}
+
+// Makes the first token of every file of the token cache a symbol, or a newline when it is
+// one. Tokens of either kind take any payload, so the file passes the checks of its sections
+// and only their hash tells that it changed
+static int test_change_token_cache()
+{
+    DIR *dir = opendir(TEST_TOKEN_CACHE);
+    if (!dir)
+    {
+        return 0;
+    }
+
+    int changed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)))
+    {
+        char path[512];
+        snprintf(path, sizeof(path), "%s/%s", TEST_TOKEN_CACHE, entry->d_name);
+        FILE *fp = strstr(entry->d_name, ".tok") ? fopen(path, "r+b") : NULL;
+        if (!fp)
+        {
+            continue;
+        }
+
+        fseek(fp, TEST_TOKEN_CACHE_KINDS, SEEK_SET);
+        int kind = fgetc(fp);
+        fseek(fp, TEST_TOKEN_CACHE_KINDS, SEEK_SET);
+        bool symbol = (kind & TOKEN_STORE_KIND_MASK) == TOKEN_TYPE_SYMBOL;
+        fputc((kind & TOKEN_STORE_WHITESPACE) | (symbol ? TOKEN_TYPE_NEWLINE : TOKEN_TYPE_SYMBOL), fp);
+        fclose(fp);
+        changed++;
+    }
+    closedir(dir);
+    return changed;
+}
+
+int main()
+{
+    token_cache_set_directory(TEST_TOKEN_CACHE);
+    struct buffer *expected[TEST_TOTAL_FILES];
+    for (size_t i = 0; i < TEST_TOTAL_FILES; i++)
+    {
+        expected[i] = test_preprocess(test_files[i], 0);
+        if (!expected[i])
+        {
+            printf("FAIL %s: can't be preprocessed\n", test_files[i]);
+            return 1;
+        }
+    }
+
+    struct buffer *include_dirs = expected[TEST_TOTAL_FILES - 1];
+    if (!memmem(buffer_ptr(include_dirs), include_dirs->len, TEST_INCLUDE_DIR_IDENTIFIER, strlen(TEST_INCLUDE_DIR_IDENTIFIER)))
+    {
+        printf("FAIL %s: the system's headers are found before the ones in %s\n", test_files[TEST_TOTAL_FILES - 1], TEST_INCLUDE_DIR);
+        return 1;
+    }
+
+    // First, so that the threads are the ones to read and lex the shared headers
+    int failed = test_threads(expected);
+    for (size_t i = 0; i < TEST_TOTAL_FILES; i++)
+    {
+        bool same = true;
+        for (size_t j = 0; j < sizeof(test_flags) / sizeof(test_flags[0]); j++)
+        {
+            if (!test_same(test_preprocess(test_files[i], test_flags[j]), expected[i]))
+            {
+                printf("FAIL %s: flags %d give other tokens\n", test_files[i], test_flags[j]);
+                same = false;
+            }
+        }
+
+        if (same)
+        {
+            printf("ok %s\n", test_files[i]);
+        }
+        failed += !same;
+    }
+
+    // Files of the token cache that changed since they were written are lexed again
+    int changed = test_change_token_cache();
+    bool same = true;
+    for (size_t i = 0; i < TEST_TOTAL_FILES; i++)
+    {
+        if (!test_same(test_preprocess(test_files[i], COMPILE_PROCESS_FLAG_TOKEN_CACHE), expected[i]))
+        {
+            printf("FAIL %s: changed files of the token cache give other tokens\n", test_files[i]);
+            same = false;
+        }
+    }
+
+    if (same)
+    {
+        printf("ok %d changed files of the token cache\n", changed);
+    }
+    failed += !same;
+
+    return failed ? 1 : 0;
+}
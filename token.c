@@ -1,8 +1,9 @@
 #include "compiler.h"
+#include "helpers/arena.h"
 
-bool is_token_keyword(struct token *token, const char *value)
+bool is_token_keyword(struct token *token, int keyword)
 {
-    return token->type == TOKEN_TYPE_KEYWORD && S_EQ(token->sval, value);
+    return token->type == TOKEN_TYPE_KEYWORD && token->keyword == keyword;
 }
 
 bool token_is_symbol(struct token *token, char c)
@@ -15,4 +16,14 @@ bool token_is_comment_newline_or_newline_seperator(struct token *token)
     return token->type == TOKEN_TYPE_NEWLINE ||
            token->type == TOKEN_TYPE_COMMENT ||
            token_is_symbol(token, '\\');
+}
+
+const char *token_between_brackets(struct compile_process *process, struct token *token)
+{
+    if (!token->between_brackets.length)
+    {
+        return NULL;
+    }
+
+    return arena_strndup(process->lexemes, compile_process_text(process, token->between_brackets.offset), token->between_brackets.length);
 }
\ No newline at end of file
@@ -0,0 +1,597 @@
+#include <stdlib.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "compiler.h"
+#include "helpers/intern.h"
+#include "helpers/buffer.h"
+
+// "TOKCACHE" read as a little endian number
+#define TOKEN_CACHE_MAGIC 0x45484341434b4f54ULL
+// Change it along with the layout of the file
+#define TOKEN_CACHE_FORMAT 2
+#define TOKEN_CACHE_INITIAL_CAPACITY 256
+
+/*
+ * A token cache file holds every token of a header in the layout of a token_store. The
+ * arrays are used in place once the file is mapped, offsets in them are relative to the
+ * header and spans and payloads are indexes, so nothing in them depends on where the file
+ * is mapped or which compile maps it.
+ *
+ * Only values hold pointers in a token_store. The file's values are ordered names first,
+ * then texts of strings and comments, then numbers, and tokens with the same name or
+ * text share one value. Names and texts are offsets into the lexemes section, so loading
+ * the file interns each distinct name once and points each distinct text into the
+ * mapping, and copies the numbers as they are.
+ *
+ * Compiles sharing headers share images laid out the same way, kept in memory by the
+ * header cache, and load them just like mapped files.
+ */
+struct token_cache_header
+{
+    uint64_t magic;
+    // Hash of the compiler version and of the layout, files of other builds are ignored
+    uint64_t version;
+    uint64_t content_hash;
+    uint64_t content_size;
+    // Hash of everything after the header. The checks of the sections only bound indexes,
+    // a kind or flags byte that changed would still pass them
+    uint64_t sections_hash;
+
+    uint32_t total_tokens;
+    uint32_t total_names;
+    uint32_t total_texts;
+    uint32_t total_values;
+    uint32_t total_spans;
+    uint32_t lexemes_size;
+
+    // Offsets of the sections from the start of the file, each 8 byte aligned
+    uint64_t kinds;
+    uint64_t flags;
+    uint64_t offsets;
+    uint64_t lengths;
+    uint64_t payloads;
+    uint64_t brackets;
+    uint64_t values;
+    uint64_t spans;
+    uint64_t lexemes;
+};
+
+// Maps a lexeme pointer to the index of its value in the file being written
+struct token_cache_value
+{
+    const char *lexeme;
+    uint32_t index;
+};
+
+// The lexemes of the file being written, every distinct one gets a single value
+struct token_cache_values
+{
+    struct token_cache_value *slots;
+    size_t capacity;
+    size_t count;
+    // Strings and comments have a copy of their text each, equal texts are interned here
+    // to be told apart by pointer like names are
+    struct intern_table *texts;
+};
+
+static const char *token_cache_directory = ".token_cache";
+
+void token_cache_set_directory(const char *dir)
+{
+    token_cache_directory = dir;
+}
+
+static uint64_t token_cache_mix(uint64_t hash, uint64_t word)
+{
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    return hash ^ hash >> 32;
+}
+
+// Hashes the input eight bytes at a time
+uint64_t token_cache_hash(const char *data, size_t size)
+{
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = token_cache_mix(hash, word);
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, size - i);
+    return token_cache_mix(token_cache_mix(hash, tail), size);
+}
+
+static uint64_t token_cache_version()
+{
+    uint64_t version = token_cache_hash(COMPILER_VERSION, strlen(COMPILER_VERSION));
+    version = token_cache_mix(version, TOKEN_CACHE_FORMAT);
+    version = token_cache_mix(version, TOTAL_KEYWORDS);
+    version = token_cache_mix(version, TOTAL_OPERATORS);
+    return token_cache_mix(version, sizeof(struct token_span));
+}
+
+// Files are named by the hash of what they hold and the version that wrote them
+static bool token_cache_path(char *path, uint64_t content_hash)
+{
+    int written = snprintf(path, PATH_MAX, "%s/%016llx-%016llx.tok", token_cache_directory, (unsigned long long)content_hash, (unsigned long long)token_cache_version());
+    return written > 0 && written < PATH_MAX;
+}
+
+static uint64_t token_cache_align(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static bool token_cache_has_value(int kind)
+{
+    switch (kind & TOKEN_STORE_KIND_MASK)
+    {
+    case TOKEN_TYPE_NUMBER:
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_STRING:
+    case TOKEN_TYPE_COMMENT:
+        return true;
+    }
+
+    return false;
+}
+
+static bool token_cache_section_fits(size_t size, uint64_t offset, uint64_t length)
+{
+    return offset % 8 == 0 && offset <= size && length <= size - offset;
+}
+
+// Whether the payload of a token of an image is an index of its kind of payload
+static bool token_cache_payload_valid(const struct token_cache_header *header, int kind, uint32_t payload)
+{
+    uint32_t total_lexemes = header->total_names + header->total_texts;
+    switch (kind)
+    {
+    case TOKEN_TYPE_IDENTIFIER:
+        return payload < header->total_names;
+
+    case TOKEN_TYPE_STRING:
+    case TOKEN_TYPE_COMMENT:
+        return payload >= header->total_names && payload < total_lexemes;
+
+    case TOKEN_TYPE_NUMBER:
+        return payload >= total_lexemes && payload < header->total_values;
+
+    case TOKEN_TYPE_KEYWORD:
+        return payload > KEYWORD_NONE && payload < TOTAL_KEYWORDS;
+
+    case TOKEN_TYPE_OPERATOR:
+        return payload > OPERATOR_NONE && payload < TOTAL_OPERATORS;
+
+    case TOKEN_TYPE_SYMBOL:
+    case TOKEN_TYPE_NEWLINE:
+        return true;
+    }
+
+    return false;
+}
+
+// Whether every token of an image, whose sections are in bounds, indexes into the image
+// and lies within the input. A store loaded from it is read without any more checks
+static bool token_cache_tokens_valid(const char *data)
+{
+    const struct token_cache_header *header = (const struct token_cache_header *)data;
+    const unsigned char *kinds = (const unsigned char *)(data + header->kinds);
+    const uint32_t *offsets = (const uint32_t *)(data + header->offsets);
+    const uint32_t *lengths = (const uint32_t *)(data + header->lengths);
+    const uint32_t *payloads = (const uint32_t *)(data + header->payloads);
+    const uint32_t *brackets = (const uint32_t *)(data + header->brackets);
+    for (uint32_t i = 0; i < header->total_tokens; i++)
+    {
+        if (!token_cache_payload_valid(header, kinds[i] & TOKEN_STORE_KIND_MASK, payloads[i]) ||
+            brackets[i] > header->total_spans || (uint64_t)offsets[i] + lengths[i] > header->content_size)
+        {
+            return false;
+        }
+    }
+
+    const struct token_span *spans = (const struct token_span *)(data + header->spans);
+    for (uint32_t i = 0; i < header->total_spans; i++)
+    {
+        if (spans[i].offset > header->content_size || spans[i].length > header->content_size - spans[i].offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Whether an image holds the tokens of an input and every section and index of it is in
+// bounds
+static bool token_cache_valid(const char *data, size_t size, struct compile_process_input_file *input, uint64_t content_hash)
+{
+    if (size < sizeof(struct token_cache_header))
+    {
+        return false;
+    }
+
+    const struct token_cache_header *header = (const struct token_cache_header *)data;
+    uint64_t tokens = header->total_tokens;
+    bool valid = header->magic == TOKEN_CACHE_MAGIC && header->version == token_cache_version() &&
+                 header->content_hash == content_hash && header->content_size == input->size &&
+                 header->sections_hash == token_cache_hash(data + sizeof(*header), size - sizeof(*header)) &&
+                 (uint64_t)header->total_names + header->total_texts <= header->total_values &&
+                 token_cache_section_fits(size, header->kinds, tokens) &&
+                 token_cache_section_fits(size, header->flags, tokens) &&
+                 token_cache_section_fits(size, header->offsets, tokens * sizeof(uint32_t)) &&
+                 token_cache_section_fits(size, header->lengths, tokens * sizeof(uint32_t)) &&
+                 token_cache_section_fits(size, header->payloads, tokens * sizeof(uint32_t)) &&
+                 token_cache_section_fits(size, header->brackets, tokens * sizeof(uint32_t)) &&
+                 token_cache_section_fits(size, header->values, (uint64_t)header->total_values * sizeof(uint64_t)) &&
+                 token_cache_section_fits(size, header->spans, (uint64_t)header->total_spans * sizeof(struct token_span)) &&
+                 token_cache_section_fits(size, header->lexemes, header->lexemes_size) &&
+                 header->lexemes_size && data[header->lexemes + header->lexemes_size - 1] == 0;
+
+    const uint64_t *values = (const uint64_t *)(data + header->values);
+    uint32_t total_lexemes = header->total_names + header->total_texts;
+    for (uint32_t i = 0; valid && i < total_lexemes; i++)
+    {
+        valid = values[i] < header->lexemes_size;
+    }
+    return valid && token_cache_tokens_valid(data);
+}
+
+// Maps the cache file of an input, NULL when there is none or it doesn't hold this input.
+// The mapping stays for as long as the process, stores loaded from it point into it
+static const char *token_cache_map(const char *path, struct compile_process_input_file *input, uint64_t content_hash)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return NULL;
+    }
+
+    if (!token_cache_valid(data, st.st_size, input, content_hash))
+    {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+    return data;
+}
+
+// A store of the tokens of a valid image for a compile. The token arrays and spans are the
+// image's own, only the values are the compile's
+static struct token_store *token_cache_load(struct compile_process *compiler, const char *image)
+{
+    const struct token_cache_header *header = (const struct token_cache_header *)image;
+    struct token_store *store = token_store_create(compiler);
+    store->mapped = true;
+    store->count = store->capacity = header->total_tokens;
+    store->kinds = (unsigned char *)(image + header->kinds);
+    store->flags = (unsigned char *)(image + header->flags);
+    store->offsets = (uint32_t *)(image + header->offsets);
+    store->lengths = (uint32_t *)(image + header->lengths);
+    store->payloads = (uint32_t *)(image + header->payloads);
+    store->brackets = (uint32_t *)(image + header->brackets);
+    store->spans = (struct token_span *)(image + header->spans);
+    store->total_spans = store->spans_capacity = header->total_spans;
+
+    const uint64_t *values = (const uint64_t *)(image + header->values);
+    const char *lexemes = image + header->lexemes;
+    store->total_values = store->values_capacity = header->total_values;
+    store->values = malloc(header->total_values * sizeof(unsigned long long) + 1);
+    uint32_t total_lexemes = header->total_names + header->total_texts;
+    for (uint32_t i = 0; i < total_lexemes; i++)
+    {
+        const char *lexeme = lexemes + values[i];
+        if (i < header->total_names)
+        {
+            lexeme = intern(compiler->interned, lexeme, strlen(lexeme));
+        }
+        store->values[i] = (uintptr_t)lexeme;
+    }
+    memcpy(&store->values[total_lexemes], &values[total_lexemes], (header->total_values - total_lexemes) * sizeof(uint64_t));
+    return store;
+}
+
+static void token_cache_grow_values(struct token_cache_values *values)
+{
+    struct token_cache_value *old_slots = values->slots;
+    size_t old_capacity = values->capacity;
+    values->capacity = old_capacity ? old_capacity * 2 : TOKEN_CACHE_INITIAL_CAPACITY;
+    values->slots = calloc(values->capacity, sizeof(struct token_cache_value));
+
+    size_t mask = values->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++)
+    {
+        if (!old_slots[i].lexeme)
+        {
+            continue;
+        }
+
+        size_t index = ((uintptr_t)old_slots[i].lexeme * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+        while (values->slots[index].lexeme)
+        {
+            index = (index + 1) & mask;
+        }
+        values->slots[index] = old_slots[i];
+    }
+    free(old_slots);
+}
+
+// The value index of a lexeme, *next is taken for it and advanced when it is new
+static uint32_t token_cache_value(struct token_cache_values *values, const char *lexeme, uint32_t *next)
+{
+    if ((values->count + 1) * 2 > values->capacity)
+    {
+        token_cache_grow_values(values);
+    }
+
+    size_t mask = values->capacity - 1;
+    size_t index = ((uintptr_t)lexeme * 0x9E3779B97F4A7C15ULL >> 32) & mask;
+    while (values->slots[index].lexeme && values->slots[index].lexeme != lexeme)
+    {
+        index = (index + 1) & mask;
+    }
+
+    if (!values->slots[index].lexeme)
+    {
+        values->slots[index] = (struct token_cache_value){.lexeme = lexeme, .index = (*next)++};
+        values->count++;
+    }
+    return values->slots[index].index;
+}
+
+// Appends a section to an image at the next 8 byte boundary, and returns where it starts
+static uint64_t token_cache_section(struct buffer *image, const void *data, size_t size)
+{
+    static const char padding[8];
+    size_t aligned = token_cache_align(image->len);
+    buffer_write_bytes(image, padding, aligned - image->len);
+    buffer_write_bytes(image, data, size);
+    return aligned;
+}
+
+// The image of the tokens of an input, laid out like its cache file
+static struct buffer *token_cache_image(struct token_store *tokens, struct compile_process_input_file *input, uint64_t content_hash)
+{
+    struct token_cache_values values = {.texts = intern_table_create()};
+    uint32_t *payloads = malloc(tokens->count * sizeof(uint32_t) + 1);
+    struct token_cache_header header = {
+        .magic = TOKEN_CACHE_MAGIC,
+        .version = token_cache_version(),
+        .content_hash = content_hash,
+        .content_size = input->size,
+        .total_tokens = tokens->count,
+        .total_spans = tokens->total_spans};
+
+    // Names, then texts, then numbers, numbers are never shared
+    for (int pass = 0; pass < 3; pass++)
+    {
+        uint32_t next = pass == 0 ? 0 : pass == 1 ? header.total_names : header.total_names + header.total_texts;
+        for (int i = 0; i < tokens->count; i++)
+        {
+            int kind = tokens->kinds[i] & TOKEN_STORE_KIND_MASK;
+            if (!token_cache_has_value(kind))
+            {
+                payloads[i] = tokens->payloads[i];
+                continue;
+            }
+
+            const char *lexeme = (const char *)(uintptr_t)tokens->values[tokens->payloads[i]];
+            if (pass == 0 && kind == TOKEN_TYPE_IDENTIFIER)
+            {
+                payloads[i] = token_cache_value(&values, lexeme, &next);
+            }
+            else if (pass == 1 && (kind == TOKEN_TYPE_STRING || kind == TOKEN_TYPE_COMMENT))
+            {
+                payloads[i] = token_cache_value(&values, intern(values.texts, lexeme, strlen(lexeme)), &next);
+            }
+            else if (pass == 2 && kind == TOKEN_TYPE_NUMBER)
+            {
+                payloads[i] = next++;
+            }
+        }
+
+        if (pass == 0)
+        {
+            header.total_names = next;
+        }
+        else if (pass == 1)
+        {
+            header.total_texts = next - header.total_names;
+        }
+        else
+        {
+            header.total_values = next;
+        }
+    }
+
+    uint64_t *file_values = malloc(header.total_values * sizeof(uint64_t) + 1);
+    struct buffer *lexemes = buffer_create();
+    // Offset 0 is never a lexeme's, every value of a lexeme is written when it is first met
+    buffer_write(lexemes, 0);
+    memset(file_values, 0, header.total_values * sizeof(uint64_t));
+    for (int i = 0; i < tokens->count; i++)
+    {
+        int kind = tokens->kinds[i] & TOKEN_STORE_KIND_MASK;
+        if (!token_cache_has_value(kind))
+        {
+            continue;
+        }
+
+        unsigned long long value = tokens->values[tokens->payloads[i]];
+        if (kind == TOKEN_TYPE_NUMBER)
+        {
+            file_values[payloads[i]] = value;
+        }
+        else if (!file_values[payloads[i]])
+        {
+            const char *lexeme = (const char *)(uintptr_t)value;
+            file_values[payloads[i]] = lexemes->len;
+            buffer_write_bytes(lexemes, lexeme, strlen(lexeme) + 1);
+        }
+    }
+    header.lexemes_size = lexemes->len;
+
+    // The header is filled in again once the offsets of the sections are known
+    struct buffer *image = buffer_create();
+    token_cache_section(image, &header, sizeof(header));
+    header.kinds = token_cache_section(image, tokens->kinds, tokens->count);
+    header.flags = token_cache_section(image, tokens->flags, tokens->count);
+    header.offsets = token_cache_section(image, tokens->offsets, tokens->count * sizeof(uint32_t));
+    header.lengths = token_cache_section(image, tokens->lengths, tokens->count * sizeof(uint32_t));
+    header.payloads = token_cache_section(image, payloads, tokens->count * sizeof(uint32_t));
+    header.brackets = token_cache_section(image, tokens->brackets, tokens->count * sizeof(uint32_t));
+    header.values = token_cache_section(image, file_values, header.total_values * sizeof(uint64_t));
+    header.spans = token_cache_section(image, tokens->spans, tokens->total_spans * sizeof(struct token_span));
+    header.lexemes = token_cache_section(image, buffer_ptr(lexemes), lexemes->len);
+    header.sections_hash = token_cache_hash(buffer_ptr(image) + sizeof(header), image->len - sizeof(header));
+    memcpy(buffer_ptr(image), &header, sizeof(header));
+
+    buffer_free(lexemes);
+    free(file_values);
+    free(payloads);
+    free(values.slots);
+    intern_table_free(values.texts);
+    return image;
+}
+
+// Writes an image to its cache file. The file is written aside under a name of its own and
+// renamed into place, so compiles running at the same time, in this process or another,
+// only ever see whole files
+static void token_cache_write(struct buffer *image, const char *path)
+{
+    char temporary[PATH_MAX];
+    mkdir(token_cache_directory, 0755);
+    if (snprintf(temporary, sizeof(temporary), "%s.XXXXXX", path) >= (int)sizeof(temporary))
+    {
+        return;
+    }
+
+    int fd = mkstemp(temporary);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    // mkstemp leaves the file readable by its owner only
+    FILE *fp = fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+    if (!fp)
+    {
+        close(fd);
+        unlink(temporary);
+        return;
+    }
+
+    bool written = fwrite(buffer_ptr(image), 1, image->len, fp) == (size_t)image->len;
+    written = fclose(fp) == 0 && written;
+    if (!written || rename(temporary, path) != 0)
+    {
+        unlink(temporary);
+    }
+}
+
+// Replaces the tokens of a lex process with the ones of an image
+static void token_cache_use(struct lex_process *process, const char *image)
+{
+    token_store_free(process->tokens);
+    process->tokens = token_cache_load(process->compiler, image);
+}
+
+// The lex process and hash of an included file the header cache loads an image for
+struct token_cache_request
+{
+    struct lex_process *process;
+    uint64_t content_hash;
+};
+
+// Loads the image every compile of the process shares for a header. It is mapped from the
+// token cache when the compile keeps one, and lexed otherwise. NULL when the header has to
+// be lexed as it's read, the lex process is left as it was then
+static const void *token_cache_shared_image(void *data)
+{
+    struct token_cache_request *request = data;
+    struct lex_process *process = request->process;
+    struct compile_process_input_file *input = lex_process_private(process);
+    char path[PATH_MAX];
+    bool keep = (process->compiler->flags & COMPILE_PROCESS_FLAG_TOKEN_CACHE) && token_cache_path(path, request->content_hash);
+    const char *mapped = keep ? token_cache_map(path, input, request->content_hash) : NULL;
+    if (mapped)
+    {
+        return mapped;
+    }
+
+    if (!preprocessor_lex_ahead(process, input))
+    {
+        return NULL;
+    }
+
+    // The image is kept for as long as the process
+    struct buffer *image = token_cache_image(process->tokens, input, request->content_hash);
+    if (keep)
+    {
+        token_cache_write(image, path);
+    }
+    return buffer_ptr(image);
+}
+
+/**
+ * Fills the store of the lex process of an included file with all of its tokens, mapped
+ * from the token cache when they are there and lexed and written to the cache otherwise.
+ * With COMPILE_PROCESS_FLAG_SHARED_HEADERS the tokens come from the header cache, so every
+ * compile of the process shares one copy of them. False when the file has to be lexed as
+ * it's read
+ */
+bool token_cache_fill(struct lex_process *process)
+{
+    struct compile_process_input_file *input = lex_process_private(process);
+    // Shared contents were hashed once when they were read
+    uint64_t content_hash = input->shared ? input->shared->content_hash : token_cache_hash(input->data, input->size);
+    if (input->shared)
+    {
+        struct token_cache_request request = {.process = process, .content_hash = content_hash};
+        const char *image = header_cache_find(content_hash, token_cache_shared_image, &request);
+        if (image)
+        {
+            token_cache_use(process, image);
+        }
+        return image != NULL;
+    }
+
+    char path[PATH_MAX];
+    if (!token_cache_path(path, content_hash))
+    {
+        return false;
+    }
+
+    const char *mapped = token_cache_map(path, input, content_hash);
+    if (mapped)
+    {
+        token_cache_use(process, mapped);
+        return true;
+    }
+
+    if (!preprocessor_lex_ahead(process, input))
+    {
+        return false;
+    }
+
+    struct buffer *image = token_cache_image(process->tokens, input, content_hash);
+    token_cache_write(image, path);
+    buffer_free(image);
+    return true;
+}
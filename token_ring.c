@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <sched.h>
+#include "compiler.h"
+
+// capacity has to be a power of two
+struct token_ring *token_ring_create(size_t capacity)
+{
+    struct token_ring *ring = aligned_alloc(64, sizeof(struct token_ring));
+    memset(ring, 0, sizeof(struct token_ring));
+    ring->tokens = calloc(capacity, sizeof(struct token));
+    ring->mask = capacity - 1;
+    return ring;
+}
+
+void token_ring_free(struct token_ring *ring)
+{
+    free(ring->tokens);
+    free(ring);
+}
+
+// Waits for room when the ring is full
+void token_ring_push(struct token_ring *ring, struct token *token)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - ring->producer_head > ring->mask)
+    {
+        ring->producer_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        while (tail - ring->producer_head > ring->mask)
+        {
+            sched_yield();
+            ring->producer_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        }
+    }
+
+    ring->tokens[tail & ring->mask] = *token;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+void token_ring_close(struct token_ring *ring)
+{
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
+
+// Waits for a token when the ring is empty, returns false once the ring is closed and
+// every token was popped
+bool token_ring_pop(struct token_ring *ring, struct token *token)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    while (head == ring->consumer_tail)
+    {
+        // Tokens are all pushed before the ring is closed, so a closed ring's tail is final
+        bool closed = atomic_load_explicit(&ring->closed, memory_order_acquire);
+        ring->consumer_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head != ring->consumer_tail)
+        {
+            break;
+        }
+
+        if (closed)
+        {
+            return false;
+        }
+        sched_yield();
+    }
+
+    *token = ring->tokens[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
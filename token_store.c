@@ -0,0 +1,434 @@
+#include <stdlib.h>
+#include "compiler.h"
+
+#define TOKEN_STORE_INITIAL_CAPACITY 1024
+
+static bool token_store_has_value(int kind)
+{
+    switch (kind & TOKEN_STORE_KIND_MASK)
+    {
+    case TOKEN_TYPE_NUMBER:
+    case TOKEN_TYPE_IDENTIFIER:
+    case TOKEN_TYPE_STRING:
+    case TOKEN_TYPE_COMMENT:
+        return true;
+    }
+
+    return false;
+}
+
+struct token_store *token_store_create(struct compile_process *compiler)
+{
+    struct token_store *store = calloc(1, sizeof(struct token_store));
+    store->compiler = compiler;
+    return store;
+}
+
+void token_store_free(struct token_store *store)
+{
+    if (store->mapped)
+    {
+        free(store->values);
+        free(store);
+        return;
+    }
+
+    free(store->kinds);
+    free(store->flags);
+    free(store->offsets);
+    free(store->lengths);
+    free(store->payloads);
+    free(store->brackets);
+    free(store->values);
+    free(store->spans);
+    free(store);
+}
+
+static void token_store_reserve(struct token_store *store, int total)
+{
+    if (total <= store->capacity)
+    {
+        return;
+    }
+
+    int capacity = store->capacity ? store->capacity : TOKEN_STORE_INITIAL_CAPACITY;
+    while (capacity < total)
+    {
+        capacity *= 2;
+    }
+
+    store->kinds = realloc(store->kinds, capacity * sizeof(unsigned char));
+    store->flags = realloc(store->flags, capacity * sizeof(unsigned char));
+    store->offsets = realloc(store->offsets, capacity * sizeof(uint32_t));
+    store->lengths = realloc(store->lengths, capacity * sizeof(uint32_t));
+    store->payloads = realloc(store->payloads, capacity * sizeof(uint32_t));
+    store->brackets = realloc(store->brackets, capacity * sizeof(uint32_t));
+    store->capacity = capacity;
+}
+
+static uint32_t token_store_push_value(struct token_store *store, unsigned long long value)
+{
+    if (store->total_values == store->values_capacity)
+    {
+        store->values_capacity = store->values_capacity ? store->values_capacity * 2 : TOKEN_STORE_INITIAL_CAPACITY;
+        store->values = realloc(store->values, store->values_capacity * sizeof(unsigned long long));
+    }
+
+    store->values[store->total_values] = value;
+    return store->total_values++;
+}
+
+static uint32_t token_store_push_span(struct token_store *store, struct token_span span)
+{
+    if (store->total_spans == store->spans_capacity)
+    {
+        store->spans_capacity = store->spans_capacity ? store->spans_capacity * 2 : TOKEN_STORE_INITIAL_CAPACITY;
+        store->spans = realloc(store->spans, store->spans_capacity * sizeof(struct token_span));
+    }
+
+    store->spans[store->total_spans++] = span;
+    return store->total_spans;
+}
+
+static uint32_t token_store_payload(struct token_store *store, struct token *token)
+{
+    switch (token->type)
+    {
+    case TOKEN_TYPE_KEYWORD:
+        return token->keyword;
+
+    case TOKEN_TYPE_OPERATOR:
+        return token->op;
+
+    case TOKEN_TYPE_SYMBOL:
+        return (unsigned char)token->cval;
+
+    case TOKEN_TYPE_NEWLINE:
+        return 0;
+    }
+
+    return token_store_push_value(store, token->llnum);
+}
+
+static uint32_t token_store_bracket(struct token_store *store, struct token_span span)
+{
+    if (!span.offset)
+    {
+        return 0;
+    }
+
+    // Every token of an expression shares its span, they're pushed one after another
+    if (store->total_spans && store->spans[store->total_spans - 1].offset == span.offset)
+    {
+        return store->total_spans;
+    }
+
+    return token_store_push_span(store, span);
+}
+
+int token_store_push(struct token_store *store, struct token *token)
+{
+    token_store_reserve(store, store->count + 1);
+    int index = store->count++;
+    store->kinds[index] = token->type | (token->whitespace ? TOKEN_STORE_WHITESPACE : 0);
+    store->flags[index] = token->flags;
+    store->offsets[index] = token->offset;
+    store->lengths[index] = token->length;
+    store->payloads[index] = token_store_payload(store, token);
+    store->brackets[index] = token_store_bracket(store, token->between_brackets);
+    return index;
+}
+
+void token_store_pop(struct token_store *store)
+{
+    int index = --store->count;
+    if (token_store_has_value(store->kinds[index]))
+    {
+        store->total_values--;
+    }
+}
+
+void token_store_read(struct token_store *store, int index, struct token *token)
+{
+    int kind = store->kinds[index];
+    uint32_t payload = store->payloads[index];
+    *token = (struct token){
+        .type = kind & TOKEN_STORE_KIND_MASK,
+        .flags = store->flags[index],
+        .offset = store->offsets[index],
+        .length = store->lengths[index],
+        .whitespace = kind & TOKEN_STORE_WHITESPACE};
+
+    switch (token->type)
+    {
+    case TOKEN_TYPE_KEYWORD:
+        token->keyword = payload;
+        token->sval = store->compiler->keywords[payload];
+        break;
+
+    case TOKEN_TYPE_OPERATOR:
+        token->op = payload;
+        token->sval = store->compiler->operators[payload];
+        break;
+
+    case TOKEN_TYPE_SYMBOL:
+        token->cval = payload;
+        break;
+
+    case TOKEN_TYPE_NEWLINE:
+        break;
+
+    default:
+        token->llnum = store->values[payload];
+    }
+
+    if (store->brackets[index])
+    {
+        token->between_brackets = store->spans[store->brackets[index] - 1];
+    }
+}
+
+void token_store_append(struct token_store *store, struct token_store *other, int start, int end, size_t offset_delta)
+{
+    token_store_reserve(store, store->count + end - start);
+    memcpy(&store->kinds[store->count], &other->kinds[start], end - start);
+    memcpy(&store->flags[store->count], &other->flags[start], end - start);
+    memcpy(&store->lengths[store->count], &other->lengths[start], (end - start) * sizeof(uint32_t));
+
+    // Values and spans are pushed again as they're met, other's spans map onto new ones
+    uint32_t other_bracket = 0;
+    uint32_t bracket = 0;
+    for (int i = start; i < end; i++)
+    {
+        int index = store->count++;
+        store->offsets[index] = other->offsets[i] + offset_delta;
+        store->payloads[index] = token_store_has_value(other->kinds[i]) ? token_store_push_value(store, other->values[other->payloads[i]]) : other->payloads[i];
+
+        if (other->brackets[i] && other->brackets[i] != other_bracket)
+        {
+            struct token_span span = other->spans[other->brackets[i] - 1];
+            span.offset += offset_delta;
+            other_bracket = other->brackets[i];
+            bracket = token_store_bracket(store, span);
+        }
+        store->brackets[index] = other->brackets[i] ? bracket : 0;
+    }
+}
+
+// Index of the first value, or span, of the tokens from index on, the total when they
+// have none. Values and spans are pushed in token order
+static uint32_t token_store_first_value(struct token_store *store, int index)
+{
+    for (int i = index; i < store->count; i++)
+    {
+        if (token_store_has_value(store->kinds[i]))
+        {
+            return store->payloads[i];
+        }
+    }
+    return store->total_values;
+}
+
+static uint32_t token_store_first_span(struct token_store *store, int index)
+{
+    for (int i = index; i < store->count; i++)
+    {
+        if (store->brackets[i])
+        {
+            return store->brackets[i] - 1;
+        }
+    }
+    return store->total_spans;
+}
+
+static void token_store_reserve_values(struct token_store *store, int total)
+{
+    if (total > store->values_capacity)
+    {
+        store->values_capacity = total * 2;
+        store->values = realloc(store->values, store->values_capacity * sizeof(unsigned long long));
+    }
+}
+
+static void token_store_reserve_spans(struct token_store *store, int total)
+{
+    if (total > store->spans_capacity)
+    {
+        store->spans_capacity = total * 2;
+        store->spans = realloc(store->spans, store->spans_capacity * sizeof(struct token_span));
+    }
+}
+
+// Replaces the tokens from start to end with other's from other_start to other_end, in
+// place. The tokens after them keep their values and spans and move along by offset_delta
+// characters. No brackets may be open across start or end, in either store
+void token_store_splice(struct token_store *store, int start, int end, struct token_store *other, int other_start, int other_end, size_t offset_delta)
+{
+    uint32_t value_start = token_store_first_value(store, start);
+    uint32_t value_end = token_store_first_value(store, end);
+    uint32_t span_start = token_store_first_span(store, start);
+    uint32_t span_end = token_store_first_span(store, end);
+    uint32_t other_span_start = 0;
+    uint32_t other_span_end = 0;
+    int total_values = 0;
+    for (int i = other_start; i < other_end; i++)
+    {
+        total_values += token_store_has_value(other->kinds[i]);
+        if (other->brackets[i])
+        {
+            other_span_start = other_span_end ? other_span_start : other->brackets[i] - 1;
+            other_span_end = other->brackets[i];
+        }
+    }
+
+    // The tokens, values and spans after the replaced ones are moved once, to where they go
+    int total = other_end - other_start;
+    int total_spans = other_span_end - other_span_start;
+    int remaining = store->count - end;
+    int remaining_values = store->total_values - value_end;
+    int remaining_spans = store->total_spans - span_end;
+    token_store_reserve(store, start + total + remaining);
+    token_store_reserve_values(store, value_start + total_values + remaining_values);
+    token_store_reserve_spans(store, span_start + total_spans + remaining_spans);
+    if (start + total != end)
+    {
+        memmove(&store->kinds[start + total], &store->kinds[end], remaining);
+        memmove(&store->flags[start + total], &store->flags[end], remaining);
+        memmove(&store->offsets[start + total], &store->offsets[end], remaining * sizeof(uint32_t));
+        memmove(&store->lengths[start + total], &store->lengths[end], remaining * sizeof(uint32_t));
+        memmove(&store->payloads[start + total], &store->payloads[end], remaining * sizeof(uint32_t));
+        memmove(&store->brackets[start + total], &store->brackets[end], remaining * sizeof(uint32_t));
+    }
+    if (value_start + total_values != value_end)
+    {
+        memmove(&store->values[value_start + total_values], &store->values[value_end], remaining_values * sizeof(unsigned long long));
+    }
+    if (span_start + total_spans != span_end)
+    {
+        memmove(&store->spans[span_start + total_spans], &store->spans[span_end], remaining_spans * sizeof(struct token_span));
+    }
+
+    memcpy(&store->kinds[start], &other->kinds[other_start], total);
+    memcpy(&store->flags[start], &other->flags[other_start], total);
+    memcpy(&store->offsets[start], &other->offsets[other_start], total * sizeof(uint32_t));
+    memcpy(&store->lengths[start], &other->lengths[other_start], total * sizeof(uint32_t));
+    if (total_spans)
+    {
+        memcpy(&store->spans[span_start], &other->spans[other_span_start], total_spans * sizeof(struct token_span));
+    }
+    uint32_t value = value_start;
+    for (int i = 0; i < total; i++)
+    {
+        int other_index = other_start + i;
+        if (token_store_has_value(other->kinds[other_index]))
+        {
+            store->values[value] = other->values[other->payloads[other_index]];
+            store->payloads[start + i] = value++;
+        }
+        else
+        {
+            store->payloads[start + i] = other->payloads[other_index];
+        }
+        store->brackets[start + i] = other->brackets[other_index] ? other->brackets[other_index] - other_span_start + span_start : 0;
+    }
+
+    // Indexes into values and spans wrap like the offsets do when they move back
+    uint32_t value_delta = value_start + total_values - value_end;
+    uint32_t span_delta = span_start + total_spans - span_end;
+    store->count = start + total + remaining;
+    store->total_values = value_start + total_values + remaining_values;
+    store->total_spans = span_start + total_spans + remaining_spans;
+    if (!offset_delta && !value_delta && !span_delta)
+    {
+        // An edit that kept the length and the tokens, the ones after it stay as they are
+        return;
+    }
+
+    for (int i = start + total; i < store->count; i++)
+    {
+        store->offsets[i] += offset_delta;
+        if (token_store_has_value(store->kinds[i]))
+        {
+            store->payloads[i] += value_delta;
+        }
+        if (store->brackets[i])
+        {
+            store->brackets[i] += span_delta;
+        }
+    }
+    for (int i = span_start + total_spans; i < store->total_spans; i++)
+    {
+        store->spans[i].offset += offset_delta;
+    }
+}
+
+// Drops the first total tokens along with the values and spans only they use. Values and
+// spans are pushed in token order, so they're dropped from the front as well
+void token_store_discard(struct token_store *store, int total)
+{
+    int remaining = store->count - total;
+    uint32_t first_value = store->total_values;
+    uint32_t first_span = store->total_spans;
+    for (int i = total; i < store->count; i++)
+    {
+        if (first_value == store->total_values && token_store_has_value(store->kinds[i]))
+        {
+            first_value = store->payloads[i];
+        }
+        if (first_span == store->total_spans && store->brackets[i])
+        {
+            first_span = store->brackets[i] - 1;
+        }
+    }
+
+    memmove(store->kinds, &store->kinds[total], remaining);
+    memmove(store->flags, &store->flags[total], remaining);
+    memmove(store->offsets, &store->offsets[total], remaining * sizeof(uint32_t));
+    memmove(store->lengths, &store->lengths[total], remaining * sizeof(uint32_t));
+    memmove(store->payloads, &store->payloads[total], remaining * sizeof(uint32_t));
+    memmove(store->brackets, &store->brackets[total], remaining * sizeof(uint32_t));
+    store->count = remaining;
+
+    store->total_values -= first_value;
+    memmove(store->values, &store->values[first_value], store->total_values * sizeof(unsigned long long));
+    store->total_spans -= first_span;
+    memmove(store->spans, &store->spans[first_span], store->total_spans * sizeof(struct token_span));
+    for (int i = 0; i < remaining; i++)
+    {
+        if (token_store_has_value(store->kinds[i]))
+        {
+            store->payloads[i] -= first_value;
+        }
+        if (store->brackets[i])
+        {
+            store->brackets[i] -= first_span;
+        }
+    }
+}
+
+void token_store_set_whitespace(struct token_store *store, int index, bool whitespace)
+{
+    store->kinds[index] = (store->kinds[index] & TOKEN_STORE_KIND_MASK) | (whitespace ? TOKEN_STORE_WHITESPACE : 0);
+}
+
+// Drops every token, keeping the memory for the next ones
+void token_store_clear(struct token_store *store)
+{
+    store->count = 0;
+    store->total_values = 0;
+    store->total_spans = 0;
+}
+
+void token_store_close_span(struct token_store *store, size_t offset, size_t end_offset)
+{
+    // Only the last expression can still be open
+    if (store->total_spans && store->spans[store->total_spans - 1].offset == offset)
+    {
+        store->spans[store->total_spans - 1].length = end_offset - offset;
+    }
+}
+
+struct position token_store_position(struct token_store *store, int index)
+{
+    return compile_process_position(store->compiler, store->offsets[index]);
+}
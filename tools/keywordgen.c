@@ -0,0 +1,204 @@
+/*
+ * Generates the keyword table used by the lexer from keywords.list.
+ *
+ * usage: keywordgen <keywords.list> <keywords.h> <keywords.c>
+ *
+ * Every keyword gets a KEYWORD_ enum value and a slot in a hash table that is searched
+ * for hash parameters until no two keywords share a slot, so a lookup is one hash, one
+ * length check and one memcmp.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdbool.h>
+
+#define KEYWORDGEN_MAX_KEYWORDS 256
+#define KEYWORDGEN_MAX_LENGTH 64
+#define KEYWORDGEN_MAX_TABLE_SIZE 4096
+
+static char keywords[KEYWORDGEN_MAX_KEYWORDS][KEYWORDGEN_MAX_LENGTH];
+static int total_keywords = 0;
+
+// Must match keyword_hash in the generated source
+static unsigned int keywordgen_hash(const char *str, size_t len, unsigned int seed, unsigned int mask)
+{
+    unsigned int hash = (unsigned char)str[0] * seed + (unsigned char)str[len - 1] + (unsigned char)str[len / 2] * 31 + len;
+    return (hash ^ (hash >> 7)) & mask;
+}
+
+static bool keywordgen_try(unsigned int seed, unsigned int mask, int *slots)
+{
+    for (unsigned int i = 0; i <= mask; i++)
+    {
+        slots[i] = -1;
+    }
+
+    for (int i = 0; i < total_keywords; i++)
+    {
+        unsigned int hash = keywordgen_hash(keywords[i], strlen(keywords[i]), seed, mask);
+        if (slots[hash] != -1)
+        {
+            return false;
+        }
+        slots[hash] = i;
+    }
+
+    return true;
+}
+
+static void keywordgen_enum_name(FILE *fp, const char *keyword)
+{
+    fprintf(fp, "KEYWORD_");
+    for (const char *c = keyword; *c; c++)
+    {
+        fputc(toupper((unsigned char)*c), fp);
+    }
+}
+
+static int keywordgen_read(const char *filename)
+{
+    FILE *fp = fopen(filename, "r");
+    if (!fp)
+    {
+        return -1;
+    }
+
+    char line[KEYWORDGEN_MAX_LENGTH];
+    while (fgets(line, sizeof(line), fp))
+    {
+        line[strcspn(line, "\r\n")] = 0x00;
+        if (line[0] == 0x00)
+        {
+            continue;
+        }
+
+        if (total_keywords == KEYWORDGEN_MAX_KEYWORDS)
+        {
+            fclose(fp);
+            return -1;
+        }
+        strcpy(keywords[total_keywords++], line);
+    }
+
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 4)
+    {
+        fprintf(stderr, "usage: %s <keywords.list> <keywords.h> <keywords.c>\n", argv[0]);
+        return 1;
+    }
+
+    if (keywordgen_read(argv[1]) != 0 || total_keywords == 0)
+    {
+        fprintf(stderr, "Unable to read the keywords from %s\n", argv[1]);
+        return 1;
+    }
+
+    static int slots[KEYWORDGEN_MAX_TABLE_SIZE];
+    unsigned int size = 1;
+    while (size < total_keywords)
+    {
+        size <<= 1;
+    }
+
+    unsigned int seed = 0;
+    bool found = false;
+    for (; size <= KEYWORDGEN_MAX_TABLE_SIZE && !found; size <<= 1)
+    {
+        for (seed = 1; seed < 100000 && !found; seed++)
+        {
+            found = keywordgen_try(seed, size - 1, slots);
+        }
+    }
+    // Both loops step past the parameters that worked
+    size >>= 1;
+    seed--;
+
+    if (!found)
+    {
+        fprintf(stderr, "Unable to find a collision free hash for the keywords\n");
+        return 1;
+    }
+
+    FILE *header = fopen(argv[2], "w");
+    FILE *source = fopen(argv[3], "w");
+    if (!header || !source)
+    {
+        fprintf(stderr, "Unable to open the output files\n");
+        return 1;
+    }
+
+    fprintf(header, "// Generated by tools/keywordgen.c from keywords.list, do not edit\n");
+    fprintf(header, "#ifndef KEYWORDS_H\n#define KEYWORDS_H\n\n#include <stddef.h>\n\n");
+    fprintf(header, "enum\n{\n    KEYWORD_NONE,\n");
+    for (int i = 0; i < total_keywords; i++)
+    {
+        fprintf(header, "    ");
+        keywordgen_enum_name(header, keywords[i]);
+        fprintf(header, ",\n");
+    }
+    fprintf(header, "    TOTAL_KEYWORDS = %i\n};\n\n", total_keywords);
+    fprintf(header, "/**\n * Returns the KEYWORD_ value of the given string or KEYWORD_NONE when it isn't a keyword\n */\n");
+    fprintf(header, "int keyword_lookup(const char *str, size_t len);\n");
+    fprintf(header, "const char *keyword_string(int keyword);\n\n#endif\n");
+
+    fprintf(source, "// Generated by tools/keywordgen.c from keywords.list, do not edit\n");
+    fprintf(source, "#include <string.h>\n#include \"keywords.h\"\n\n");
+    fprintf(source, "#define KEYWORD_HASH_SEED %u\n#define KEYWORD_HASH_MASK %u\n\n", seed, size - 1);
+    fprintf(source, "struct keyword_slot\n{\n    const char *str;\n    size_t len;\n    int keyword;\n};\n\n");
+    fprintf(source, "static const struct keyword_slot keyword_slots[KEYWORD_HASH_MASK + 1] = {\n");
+    for (unsigned int i = 0; i < size; i++)
+    {
+        if (slots[i] == -1)
+        {
+            continue;
+        }
+
+        fprintf(source, "    [%u] = {\"%s\", %zu, ", i, keywords[slots[i]], strlen(keywords[slots[i]]));
+        keywordgen_enum_name(source, keywords[slots[i]]);
+        fprintf(source, "},\n");
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source, "static const char *keyword_strings[TOTAL_KEYWORDS + 1] = {\n");
+    for (int i = 0; i < total_keywords; i++)
+    {
+        fprintf(source, "    [");
+        keywordgen_enum_name(source, keywords[i]);
+        fprintf(source, "] = \"%s\",\n", keywords[i]);
+    }
+    fprintf(source, "};\n\n");
+
+    fprintf(source,
+            "static unsigned int keyword_hash(const char *str, size_t len)\n"
+            "{\n"
+            "    unsigned int hash = (unsigned char)str[0] * KEYWORD_HASH_SEED + (unsigned char)str[len - 1] + (unsigned char)str[len / 2] * 31 + len;\n"
+            "    return (hash ^ (hash >> 7)) & KEYWORD_HASH_MASK;\n"
+            "}\n\n"
+            "int keyword_lookup(const char *str, size_t len)\n"
+            "{\n"
+            "    if (len == 0)\n"
+            "    {\n"
+            "        return KEYWORD_NONE;\n"
+            "    }\n\n"
+            "    const struct keyword_slot *slot = &keyword_slots[keyword_hash(str, len)];\n"
+            "    if (slot->len != len || memcmp(slot->str, str, len) != 0)\n"
+            "    {\n"
+            "        return KEYWORD_NONE;\n"
+            "    }\n\n"
+            "    return slot->keyword;\n"
+            "}\n\n"
+            "const char *keyword_string(int keyword)\n"
+            "{\n"
+            "    return keyword_strings[keyword];\n"
+            "}\n");
+
+    fclose(header);
+    fclose(source);
+    return 0;
+}
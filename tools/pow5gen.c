@@ -0,0 +1,145 @@
+/*
+ * Generates the table of powers of five used to convert decimal constants to doubles.
+ *
+ * usage: pow5gen <pow5.c>
+ *
+ * Every power of five from 5^-342 to 5^308 is written as the 128 most significant bits
+ * of its binary expansion, high word first. Positive powers are truncated, negative ones
+ * are rounded up, which is what the conversion in helpers/decimal.c relies on.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define POW5GEN_SMALLEST_POWER -342
+#define POW5GEN_LARGEST_POWER 308
+// Enough 32 bit words for 2^1800, the largest dividend needed
+#define POW5GEN_TOTAL_WORDS 64
+
+struct pow5gen_number
+{
+    uint32_t words[POW5GEN_TOTAL_WORDS];
+};
+
+static void pow5gen_set(struct pow5gen_number *number, uint32_t value)
+{
+    memset(number, 0, sizeof(struct pow5gen_number));
+    number->words[0] = value;
+}
+
+static void pow5gen_multiply(struct pow5gen_number *number, uint32_t value)
+{
+    uint64_t carry = 0;
+    for (int i = 0; i < POW5GEN_TOTAL_WORDS; i++)
+    {
+        uint64_t product = (uint64_t)number->words[i] * value + carry;
+        number->words[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+}
+
+static void pow5gen_divide(struct pow5gen_number *number, uint32_t value)
+{
+    uint64_t remainder = 0;
+    for (int i = POW5GEN_TOTAL_WORDS - 1; i >= 0; i--)
+    {
+        uint64_t dividend = remainder << 32 | number->words[i];
+        number->words[i] = (uint32_t)(dividend / value);
+        remainder = dividend % value;
+    }
+}
+
+static void pow5gen_add_one(struct pow5gen_number *number)
+{
+    for (int i = 0; i < POW5GEN_TOTAL_WORDS && ++number->words[i] == 0; i++)
+    {
+    }
+}
+
+static int pow5gen_bit_length(struct pow5gen_number *number)
+{
+    for (int i = POW5GEN_TOTAL_WORDS - 1; i >= 0; i--)
+    {
+        if (number->words[i])
+        {
+            return i * 32 + 32 - __builtin_clz(number->words[i]);
+        }
+    }
+    return 0;
+}
+
+static int pow5gen_bit(struct pow5gen_number *number, int bit)
+{
+    return bit >= 0 && (number->words[bit / 32] >> (bit % 32)) & 1;
+}
+
+// Writes bits [shift, shift + 128) of number, truncating below shift and padding with
+// zeros when shift is negative
+static void pow5gen_write(FILE *fp, struct pow5gen_number *number, int shift)
+{
+    uint64_t high = 0;
+    uint64_t low = 0;
+    for (int bit = 127; bit >= 0; bit--)
+    {
+        uint64_t *word = bit >= 64 ? &high : &low;
+        *word = *word << 1 | pow5gen_bit(number, bit + shift);
+    }
+    fprintf(fp, "    {0x%016llxULL, 0x%016llxULL},\n", (unsigned long long)high, (unsigned long long)low);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "usage: pow5gen <pow5.c>\n");
+        return 1;
+    }
+
+    FILE *fp = fopen(argv[1], "w");
+    if (!fp)
+    {
+        fprintf(stderr, "pow5gen: unable to write %s\n", argv[1]);
+        return 1;
+    }
+
+    fprintf(fp, "// Generated by tools/pow5gen.c, do not edit\n");
+    fprintf(fp, "#include <stdint.h>\n\n");
+    fprintf(fp, "const uint64_t decimal_pow5_128[%d][2] = {\n", POW5GEN_LARGEST_POWER - POW5GEN_SMALLEST_POWER + 1);
+
+    struct pow5gen_number power;
+    struct pow5gen_number quotient;
+    for (int q = POW5GEN_SMALLEST_POWER; q < 0; q++)
+    {
+        // z is the smallest amount of bits that holds 5^-q, never a power of two itself
+        pow5gen_set(&power, 1);
+        for (int i = 0; i < -q; i++)
+        {
+            pow5gen_multiply(&power, 5);
+        }
+        int z = pow5gen_bit_length(&power);
+
+        // 2^b / 5^-q, dividing by five at a time rounds down just like one division
+        int b = q >= -27 ? z + 127 : 2 * z + 128;
+        pow5gen_set(&quotient, 0);
+        quotient.words[b / 32] = 1u << (b % 32);
+        for (int i = 0; i < -q; i++)
+        {
+            pow5gen_divide(&quotient, 5);
+        }
+        pow5gen_add_one(&quotient);
+
+        int length = pow5gen_bit_length(&quotient);
+        pow5gen_write(fp, &quotient, length > 128 ? length - 128 : 0);
+    }
+
+    pow5gen_set(&power, 1);
+    for (int q = 0; q <= POW5GEN_LARGEST_POWER; q++)
+    {
+        pow5gen_write(fp, &power, pow5gen_bit_length(&power) - 128);
+        pow5gen_multiply(&power, 5);
+    }
+
+    fprintf(fp, "};\n");
+    fclose(fp);
+    return 0;
+}